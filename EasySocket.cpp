@@ -1,6 +1,8 @@
 #include "EasySocket.h"
 #include "SocketDelegate.h"
 #include "easylogging++.h"
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <thread>
 
@@ -9,133 +11,443 @@
 // Otherwise, it'll throw `symbol not found` exceptions when compiling.
 EasySocket::EasySocket(const std::string& url, SocketDelegate* delegate)
     : WebSocket(url, delegate)
-    , receiveQueue(1) {
+    , receiveQueue(new PhxSerialQueue()) {
     this->state = SocketClosed;
+    this->registration = 0;
+    this->watchedFd = -1;
+    this->outboundDepth = 0;
+    this->lingerTime = std::chrono::microseconds(0);
+    this->lingerBytes = 0;
+    this->pollTimer = 0;
+    this->pollTimerArmed = false;
+}
+
+EasySocket::EasySocket(const std::string& url,
+    SocketDelegate* delegate,
+    std::shared_ptr<PhxReactor> reactor)
+    : WebSocket(url, delegate)
+    , reactor(std::move(reactor)) {
+    this->state = SocketClosed;
+    this->registration = 0;
+    this->watchedFd = -1;
+    this->outboundDepth = 0;
+    this->lingerTime = std::chrono::microseconds(0);
+    this->lingerBytes = 0;
+    this->pollTimer = 0;
+    this->pollTimerArmed = false;
+}
+
+EasySocket::~EasySocket() {
+    // Detach first so the handler cannot schedule another poll timer.
+    if (this->reactor && this->registration) {
+        this->reactor->detach(this->registration);
+    }
+
+    // Waits for the callback if it is running, as it captures this.
+    PhxTimerWheel::TimerId timer = this->pollTimer.exchange(0);
+    if (timer) {
+        PhxTimerWheel::shared().cancel(timer);
+    }
+
+    // Closes the connection's descriptors and stops any name resolution
+    // still calling back into us.
+    std::atomic_store(
+        &this->socket, std::shared_ptr<easywsclient::WebSocket>());
 }
 
 void EasySocket::open() {
-    easywsclient::WebSocket::pointer socket
-        = easywsclient::WebSocket::from_url(this->url);
+    // Only a malformed url fails here; everything else is reported from
+    // the I/O thread once the connection attempt plays out.
+    std::shared_ptr<easywsclient::WebSocket> socket(
+        easywsclient::WebSocket::from_url_async(
+            this->url, std::string(), this->connectOptions));
 
     if (!socket) {
         this->state = SocketClosed;
-        std::thread errorThread([this]() {
-            SocketDelegate* d = this->delegate;
-            if (d) {
-                d->webSocketDidError(this, "");
-            }
-        });
-        errorThread.detach();
+        // The thread may outlive us, so it must not read our members.
+        SocketDelegate* d = this->delegate;
+        if (d) {
+            std::thread errorThread(
+                [this, d]() { d->webSocketDidError(this, ""); });
+            errorThread.detach();
+        }
 
-        this->socket = nullptr;
+        std::atomic_store(
+            &this->socket, std::shared_ptr<easywsclient::WebSocket>());
         return;
     }
 
-    this->socket = socket;
+    socket->setTxLinger((int)this->lingerTime.count(), this->lingerBytes);
 
-    std::thread worker([this]() {
-        easywsclient::WebSocket::pointer ws = this->socket;
-        // This worker thread will continue to loop as long as the Websocket
-        // is connected. Once we get a CLOSED message, this will be set to
-        // false and the loop (and thread) will be exited.
-        bool shouldContinueLoop = true;
-
-        // We use this flag to track if we've triggered the webSocketDidOpen
-        // yet. The first time we encounter CONNECTED while looping, trigger
-        // the callback and then set this to true so we only do it once.
-        bool triggeredWebsocketJoinedCallback = false;
-
-        using std::placeholders::_1;
-        std::function<void(std::string)> callable
-            = std::bind(&EasySocket::handleMessage, this, _1);
-
-        while (shouldContinueLoop) {
-            switch (ws->getReadyState()) {
-            case easywsclient::WebSocket::CLOSED: {
-                this->state = SocketClosed;
-                std::thread closeThread([this]() {
-                    SocketDelegate* d = this->delegate;
-                    if (d) {
-                        d->webSocketDidClose(this, 0, "", true);
-                    }
-                });
-                closeThread.detach();
-
-                // We got a CLOSED so the loop should stop.
-                shouldContinueLoop = false;
-                break;
+    // We use this flag to track if we've triggered the webSocketDidOpen
+    // yet. The first time we encounter CONNECTED while looping, trigger
+    // the callback and then set this to true so we only do it once.
+    this->triggeredWebsocketJoinedCallback = false;
+
+    if (this->reactor) {
+        // The reactor's I/O thread services the socket whenever it becomes
+        // ready or we notify it; there is no thread of our own.
+        if (this->registration) {
+            this->reactor->detach(this->registration);
+        }
+        std::atomic_store(&this->socket, socket);
+
+        // The handler holds the socket until it is detached, so the
+        // descriptors are closed only once the reactor no longer
+        // watches them.
+        this->registration = this->reactor->attach([this, socket]() {
+            if (!this->step(socket.get())) {
+                this->reactor->detach(this->registration);
+                this->registration = 0;
+                this->watchedFd = -1;
+                std::shared_ptr<easywsclient::WebSocket> current = socket;
+                std::atomic_compare_exchange_strong(&this->socket, &current,
+                    std::shared_ptr<easywsclient::WebSocket>());
+                return;
             }
-            case easywsclient::WebSocket::CLOSING: {
-                this->state = SocketClosing;
-                std::lock_guard<std::mutex> guard(this->socketMutex);
-                ws->poll();
-                ws->dispatch(callable);
-                break;
+
+            // The descriptor appears, and may change, while connecting.
+            int fd = socket->getFd();
+            if (fd != this->watchedFd) {
+                this->watchedFd = fd;
+                this->reactor->watch(this->registration, fd);
+                // Edge-triggered: make sure readiness that predates the
+                // watch is not missed.
+                this->reactor->notify(this->registration);
             }
-            case easywsclient::WebSocket::CONNECTING: {
-                this->state = SocketConnecting;
-                std::lock_guard<std::mutex> guard(this->socketMutex);
-                ws->poll();
-                ws->dispatch(callable);
-                break;
+
+            this->schedulePollTimer(socket.get());
+        });
+        this->watchedFd = -1;
+
+        // Name resolution finishes on a helper thread.
+        socket->setWakeCallback([this]() {
+            PhxReactor::Registration reg = this->registration;
+            if (reg) {
+                this->reactor->notify(reg);
             }
-            case easywsclient::WebSocket::OPEN: {
-                this->state = SocketOpen;
-                if (!triggeredWebsocketJoinedCallback) {
-                    triggeredWebsocketJoinedCallback = true;
-                    this->getSocketState();
-                    SocketDelegate* d = this->delegate;
-                    if (d) {
-                        d->webSocketDidOpen(this);
-                    }
+        });
+        this->reactor->notify(this->registration);
+        return;
+    }
+
+    std::atomic_store(&this->socket, socket);
+    std::thread worker([this, socket]() {
+        easywsclient::WebSocket::pointer ws = socket.get();
+        // This worker thread will continue to loop as long as the Websocket
+        // is connected. Once we get a CLOSED message, step returns false
+        // and the loop (and thread) will be exited.
+        while (this->step(ws)) {
+            // Sleep in the kernel until the socket is readable, writable with
+            // pending data, or send()/close() wakes us up. The socket mutex
+            // is deliberately not held here so senders are never blocked.
+            ws->wait(-1);
+        }
+
+        // Unless open() has moved on to a new connection, drop ours; the
+        // captured reference then closes it when the thread exits.
+        std::shared_ptr<easywsclient::WebSocket> current = socket;
+        if (std::atomic_compare_exchange_strong(&this->socket, &current,
+                std::shared_ptr<easywsclient::WebSocket>())) {
+            this->state = SocketClosed;
+        }
+    });
+
+    worker.detach();
+}
+
+bool EasySocket::step(easywsclient::WebSocket::pointer ws) {
+    // Move a pending connection along first, so a connection that opens
+    // here triggers webSocketDidOpen before its first message.
+    if (ws->getReadyState() == easywsclient::WebSocket::CONNECTING) {
+        std::lock_guard<std::mutex> guard(this->socketMutex);
+        ws->poll();
+    }
+
+    switch (ws->getReadyState()) {
+    case easywsclient::WebSocket::CLOSED: {
+        this->state = SocketClosed;
+        // A socket that never opened failed to connect.
+        bool opened = this->triggeredWebsocketJoinedCallback;
+        // The owner may destroy us as soon as the socket closes, so the
+        // delegate is read now rather than on the thread.
+        SocketDelegate* d = this->delegate;
+        if (d) {
+            std::thread closeThread([this, d, opened]() {
+                if (opened) {
+                    d->webSocketDidClose(this, 0, "", true);
+                } else {
+                    d->webSocketDidError(this, "");
                 }
+            });
+            closeThread.detach();
+        }
 
-                std::lock_guard<std::mutex> guard(this->socketMutex);
-                ws->poll();
-                ws->dispatch(callable);
-                break;
+        // We got a CLOSED so the loop should stop.
+        return false;
+    }
+    case easywsclient::WebSocket::CLOSING: {
+        this->state = SocketClosing;
+        break;
+    }
+    case easywsclient::WebSocket::CONNECTING: {
+        this->state = SocketConnecting;
+        return true;
+    }
+    case easywsclient::WebSocket::OPEN: {
+        this->state = SocketOpen;
+        if (!this->triggeredWebsocketJoinedCallback) {
+            this->triggeredWebsocketJoinedCallback = true;
+            this->getSocketState();
+            SocketDelegate* d = this->delegate;
+            if (d) {
+                d->webSocketDidOpen(this);
             }
-            default: { break; }
+        }
+        break;
+    }
+    default: { break; }
+    }
+
+    std::lock_guard<std::mutex> guard(this->socketMutex);
+    this->drainOutbound(ws);
+    ws->poll();
+    ws->dispatchMessage(
+        [this](const std::vector<uint8_t>& message, bool binary) {
+            if (binary) {
+                this->handleBinaryMessage(
+                    std::vector<uint8_t>(message.begin(), message.end()));
+            } else {
+                this->handleMessage(
+                    std::string(message.begin(), message.end()));
             }
+        });
+    return true;
+}
+
+void EasySocket::wake(easywsclient::WebSocket::pointer ws) {
+    if (this->reactor) {
+        PhxReactor::Registration reg = this->registration;
+        if (reg) {
+            this->reactor->notify(reg);
         }
+    } else {
+        ws->interrupt();
+    }
+}
 
-        this->state = SocketClosed;
-        this->socket = nullptr;
-    });
+void EasySocket::schedulePollTimer(easywsclient::WebSocket::pointer ws) {
+    int timeout = ws->nextTimeout();
+    if (timeout <= 0) {
+        return;
+    }
 
-    worker.detach();
+    // A timer armed for later work, such as a connect phase deadline, must
+    // not hold back frames that fall due sooner.
+    std::chrono::steady_clock::time_point due
+        = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    if (this->pollTimerArmed && due >= this->pollTimerDue) {
+        return;
+    }
+
+    // Drops the previous timer, or if it has fired, waits for a callback
+    // that may still be running, so only the timer in pollTimer can be
+    // using this.
+    PhxTimerWheel::TimerId previous = this->pollTimer;
+    if (previous) {
+        PhxTimerWheel::shared().cancel(previous);
+    }
+
+    this->pollTimerArmed = true;
+    this->pollTimerDue = due;
+    this->pollTimer = PhxTimerWheel::shared().schedule(
+        std::chrono::milliseconds(timeout), [this]() {
+            this->pollTimerArmed = false;
+            PhxReactor::Registration reg = this->registration;
+            if (reg) {
+                this->reactor->notify(reg);
+            }
+        });
+}
+
+void EasySocket::setWriteCoalescing(
+    std::chrono::microseconds linger, size_t bytes) {
+    this->lingerTime = linger;
+    this->lingerBytes = bytes;
+
+    std::shared_ptr<easywsclient::WebSocket> sock
+        = std::atomic_load(&this->socket);
+    if (sock) {
+        // Safe from any thread; the wakeup makes the I/O thread re-check
+        // when lingering frames fall due.
+        sock->setTxLinger((int)linger.count(), bytes);
+        this->wake(sock.get());
+    }
+}
+
+void EasySocket::setDirectDelivery(bool direct) {
+    if (this->reactor) {
+        return;
+    }
+
+    if (direct) {
+        this->receiveQueue.reset();
+    } else if (!this->receiveQueue) {
+        this->receiveQueue.reset(new PhxSerialQueue());
+    }
+}
+
+easywsclient::WebSocket::Stats EasySocket::getTransportStats() {
+    std::shared_ptr<easywsclient::WebSocket> sock
+        = std::atomic_load(&this->socket);
+    if (!sock) {
+        easywsclient::WebSocket::Stats stats = easywsclient::WebSocket::Stats();
+        return stats;
+    }
+
+    std::lock_guard<std::mutex> guard(this->socketMutex);
+    return sock->getStats();
+}
+
+void EasySocket::setConnectOptions(
+    const easywsclient::WebSocket::ConnectOptions& options) {
+    this->connectOptions = options;
+}
+
+easywsclient::WebSocket::ConnectTimings EasySocket::getConnectTimings() {
+    std::shared_ptr<easywsclient::WebSocket> sock
+        = std::atomic_load(&this->socket);
+    if (!sock) {
+        easywsclient::WebSocket::ConnectTimings timings
+            = easywsclient::WebSocket::ConnectTimings();
+        return timings;
+    }
+
+    std::lock_guard<std::mutex> guard(this->socketMutex);
+    return sock->getConnectTimings();
 }
 
 void EasySocket::close() {
     this->state = SocketClosed;
+    // Hold a reference in case the I/O thread drops the socket meanwhile.
+    std::shared_ptr<easywsclient::WebSocket> sock
+        = std::atomic_load(&this->socket);
     // Was already closed or never opened.
-    if (!this->socket) {
+    if (!sock) {
         return;
     }
 
-    this->socket->close();
+    // The I/O thread closes it, so its descriptors are never closed while
+    // that thread or the reactor still uses them.
+    sock->requestClose();
 }
 
 void EasySocket::send(const std::string& message) {
-    std::thread thread([this, message]() {
-        std::lock_guard<std::mutex> guard(this->socketMutex);
-        // Grab a copy of the pointer in case it gets NULLed out.
-        easywsclient::WebSocket::pointer sock = this->socket;
-        if (sock && this->state == SocketOpen) {
-            sock->send(message);
+    this->enqueue(message.data(), message.size(), false);
+}
+
+void EasySocket::sendBinary(const std::vector<uint8_t>& message) {
+    this->enqueue(message.data(), message.size(), true);
+}
+
+void EasySocket::enqueue(const void* data, size_t size, bool binary) {
+    // Hold a reference in case the I/O thread drops the socket meanwhile.
+    std::shared_ptr<easywsclient::WebSocket> sock
+        = std::atomic_load(&this->socket);
+    if (!sock || this->state != SocketOpen) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->outboundMutex);
+        OutboundHeader header = { size, binary };
+        size_t offset = this->outbound.size();
+        this->outbound.resize(offset + sizeof(header) + size);
+        std::memcpy(&this->outbound[offset], &header, sizeof(header));
+        std::memcpy(&this->outbound[offset + sizeof(header)], data, size);
+        this->outboundDepth++;
+    }
+
+    // Wake the I/O thread so the frame is flushed right away.
+    this->wake(sock.get());
+}
+
+void EasySocket::drainOutbound(easywsclient::WebSocket::pointer ws) {
+    {
+        std::lock_guard<std::mutex> guard(this->outboundMutex);
+        if (this->outbound.empty()) {
+            return;
         }
-    });
-    thread.detach();
+        this->outbound.swap(this->draining);
+    }
+
+    size_t count = 0;
+    size_t offset = 0;
+    while (offset < this->draining.size()) {
+        OutboundHeader header;
+        std::memcpy(&header, &this->draining[offset], sizeof(header));
+        offset += sizeof(header);
+        if (header.binary) {
+            ws->sendBinary(
+                reinterpret_cast<const uint8_t*>(&this->draining[offset]),
+                header.size);
+        } else {
+            ws->send(&this->draining[offset], header.size);
+        }
+        offset += header.size;
+        count++;
+    }
+
+    this->draining.clear();
+    this->outboundDepth -= count;
 }
 
-void EasySocket::handleMessage(const std::string& message) {
+size_t EasySocket::getOutboundQueueDepth() {
+    return this->outboundDepth;
+}
+
+void EasySocket::handleMessage(std::string message) {
     LOG(INFO) << message + "\n";
-    this->receiveQueue.enqueue([this, message]() {
+    if (!this->receiveQueue) {
+        // Reactor and direct delivery sockets deliver on the I/O thread
+        // rather than keeping a receive thread per connection. Delegates
+        // are expected to hand the message off quickly, as PhxSocket does.
         SocketDelegate* d = this->delegate;
         if (d) {
-            d->webSocketDidReceive(this, message);
+            d->webSocketDidReceive(this, std::move(message));
         }
-    });
+        return;
+    }
+
+    // Lambdas cannot capture by move in C++11, so the buffer is bound
+    // rather than copied into the lambda.
+    this->receiveQueue->post(std::bind(
+        [this](std::string& message) {
+            SocketDelegate* d = this->delegate;
+            if (d) {
+                d->webSocketDidReceive(this, std::move(message));
+            }
+        },
+        std::move(message)));
+}
+
+void EasySocket::handleBinaryMessage(std::vector<uint8_t> message) {
+    if (!this->receiveQueue) {
+        SocketDelegate* d = this->delegate;
+        if (d) {
+            d->webSocketDidReceiveBinary(this, std::move(message));
+        }
+        return;
+    }
+
+    this->receiveQueue->post(std::bind(
+        [this](std::vector<uint8_t>& message) {
+            SocketDelegate* d = this->delegate;
+            if (d) {
+                d->webSocketDidReceiveBinary(this, std::move(message));
+            }
+        },
+        std::move(message)));
 }
 
 SocketState EasySocket::getSocketState() {
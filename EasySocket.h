@@ -5,38 +5,182 @@
  *  easywsclient is relatively spartan, not passing callbacks when expected.
  *  It is wrapped to fake those callbacks.
  *
+ *  By default each EasySocket services its connection on a worker thread of
+ *  its own. When constructed with a PhxReactor the connection is serviced by
+ *  the reactor's shared I/O threads instead.
+ *
+ *  open() returns straight away; resolving, connecting and the handshake
+ *  all happen on the thread servicing the socket.
+ *
+ *  Received messages are handed to the delegate on a receive thread of
+ *  their own, unless the socket has a reactor or direct delivery is set,
+ *  in which case the thread servicing the socket calls the delegate.
+ *
  */
 #ifndef EasySocket_H
 #define EasySocket_H
 
+#include "PhxReactor.h"
+#include "PhxSerialQueue.h"
+#include "PhxTimerWheel.h"
 #include "SocketDelegate.h"
-#include "ThreadPool.h"
 #include "WebSocket.h"
 #include "easywsclient.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 
 class EasySocket : public WebSocket {
 private:
-    /*!< Queue used for receiving messages. */
-    ThreadPool receiveQueue;
+    /*!<
+     * Queue used for receiving messages, null with a reactor or direct
+     * delivery.
+     */
+    std::unique_ptr<PhxSerialQueue> receiveQueue;
+
+    /*!< The reactor servicing this socket, if any. */
+    std::shared_ptr<PhxReactor> reactor;
+
+    /*!<
+     * This socket's registration with reactor, 0 when not attached. Read by
+     * the resolver and the poll timer, hence atomic.
+     */
+    std::atomic<PhxReactor::Registration> registration;
+
+    /*!< The descriptor registration watches. Only the I/O thread uses it. */
+    int watchedFd;
+
+    /*!< Timeouts for each phase of connecting. */
+    easywsclient::WebSocket::ConnectOptions connectOptions;
 
     /*!< The mutex used when sending/polling messages over the socket. */
     std::mutex socketMutex;
 
-    /*!< The underlying socket EasySocket wraps. */
-    easywsclient::WebSocket::pointer socket;
+    /*!<
+     * The underlying socket EasySocket wraps. Replaced by open() and
+     * cleared by the I/O thread while other threads use it, so only
+     * accessed with std::atomic_load and std::atomic_store. Whoever drops
+     * the last reference closes its descriptors.
+     */
+    std::shared_ptr<easywsclient::WebSocket> socket;
 
     /*!< Keep track of Socket State.
       This is used instead of easywsclient's SocketState. */
     SocketState state;
 
+    /*!< Whether webSocketDidOpen was triggered for the current connection. */
+    bool triggeredWebsocketJoinedCallback;
+
+    /*!< Guards outbound. */
+    std::mutex outboundMutex;
+
+    /*!< What outbound stores ahead of each message. */
+    struct OutboundHeader {
+        size_t size;
+        bool binary;
+    };
+
+    /*!<
+     * Messages queued by send() and sendBinary(), each stored as an
+     * OutboundHeader followed by the message bytes. The I/O thread swaps
+     * this with draining so both buffers keep their capacity and
+     * steady-state sends allocate nothing.
+     */
+    std::vector<char> outbound;
+
+    /*!< The buffer the I/O thread is writing out. Only it touches this. */
+    std::vector<char> draining;
+
+    /*!< Number of messages in outbound not yet handed to the socket. */
+    std::atomic<size_t> outboundDepth;
+
+    /*!< How long a frame may wait to be coalesced with later ones. */
+    std::chrono::microseconds lingerTime;
+
+    /*!< Pending bytes that flush coalesced frames early, 0 for no limit. */
+    size_t lingerBytes;
+
+    /*!<
+     * Wheel timer for the socket's timed work in reactor mode. Holds the
+     * last timer scheduled even once it has fired, so the destructor can
+     * wait out a callback still running.
+     */
+    std::atomic<PhxTimerWheel::TimerId> pollTimer;
+
+    /*!< Whether pollTimer is scheduled and has not fired yet. */
+    std::atomic<bool> pollTimerArmed;
+
+    /*!< When an armed pollTimer fires. Only the I/O thread uses it. */
+    std::chrono::steady_clock::time_point pollTimerDue;
+
+    /**
+     *  \brief Arms pollTimer if the socket has timed work pending.
+     *
+     *  Reactor sockets have no thread blocked in wait() to notice when
+     *  coalesced frames fall due or a connect phase times out, so a timer
+     *  notifies the reactor instead.
+     *
+     *  \param ws The socket being serviced.
+     *  \return void
+     */
+    void schedulePollTimer(easywsclient::WebSocket::pointer ws);
+
+    /**
+     *  \brief Hands every queued message to the socket in FIFO order.
+     *
+     *  Called on the I/O thread with socketMutex held.
+     *
+     *  \param ws The socket to write to.
+     *  \return void
+     */
+    void drainOutbound(easywsclient::WebSocket::pointer ws);
+
+    /**
+     *  \brief Queues a message and wakes the I/O thread to write it.
+     *
+     *  \param data The message bytes.
+     *  \param size The number of bytes.
+     *  \param binary Whether to send a binary rather than a text frame.
+     *  \return void
+     */
+    void enqueue(const void* data, size_t size, bool binary);
+
     /**
      *  \brief Function used to trigger WebSocket::webSocketDidReceive.
      *
      *  \param message received.
      *  \return void
      */
-    void handleMessage(const std::string& message);
+    void handleMessage(std::string message);
+
+    /**
+     *  \brief Function used to trigger WebSocket::webSocketDidReceiveBinary.
+     *
+     *  \param message received.
+     *  \return void
+     */
+    void handleBinaryMessage(std::vector<uint8_t> message);
+
+    /**
+     *  \brief Services the socket once without blocking.
+     *
+     *  Updates state, triggers open/close callbacks, then polls and
+     *  dispatches any received messages.
+     *
+     *  \param ws The socket being serviced.
+     *  \return bool false once the socket has closed.
+     */
+    bool step(easywsclient::WebSocket::pointer ws);
+
+    /**
+     *  \brief Wakes whichever thread services the socket.
+     *
+     *  \param ws The socket to wake.
+     *  \return void
+     */
+    void wake(easywsclient::WebSocket::pointer ws);
 
 public:
     // Make sure to implement this constructor if you take out the
@@ -44,15 +188,95 @@ public:
     // Otherwise, it'll throw `symbol not found` exceptions when compiling.
     EasySocket(const std::string& url, SocketDelegate* delegate);
 
+    /**
+     *  \brief Constructor for a socket serviced by a shared reactor.
+     *
+     *  \param url The url to connect to.
+     *  \param delegate The delegate to receive WebSocket callbacks.
+     *  \param reactor The reactor whose I/O threads service this socket.
+     *  \return EasySocket
+     */
+    EasySocket(const std::string& url,
+        SocketDelegate* delegate,
+        std::shared_ptr<PhxReactor> reactor);
+
+    ~EasySocket();
+
     // WebSocket
     void open();
     void close();
     void send(const std::string& message);
+    void sendBinary(const std::vector<uint8_t>& message);
     SocketState getSocketState();
     void setDelegate(SocketDelegate* delegate);
     SocketDelegate* getDelegate();
     void setURL(const std::string& url);
     // WebSocket
+
+    /**
+     *  \brief Number of messages queued by send() or sendBinary() not yet
+     *  written out.
+     *
+     *  \return size_t
+     */
+    size_t getOutboundQueueDepth();
+
+    /**
+     *  \brief Coalesces bursts of outgoing frames into fewer writes.
+     *
+     *  Frames are held back until bytes are pending or the oldest has
+     *  waited linger, then all pending frames go out in one write.
+     *  A linger of zero (the default) writes frames as soon as possible.
+     *
+     *  \param linger Longest time a frame may be held back.
+     *  \param bytes Pending size that flushes early, 0 for no limit.
+     *  \return void
+     */
+    void setWriteCoalescing(std::chrono::microseconds linger, size_t bytes);
+
+    /**
+     *  \brief Delivers received messages on the thread servicing the socket.
+     *
+     *  Without this each message is passed to a receive thread before the
+     *  delegate sees it. Delegates that only hand messages off to a queue
+     *  of their own, as PhxSocket does, can skip that hop. Messages are
+     *  then passed as rvalues, in order, and the delegate must not block.
+     *
+     *  Sockets with a reactor always deliver directly. Must be called
+     *  before open().
+     *
+     *  \param direct Whether to skip the receive thread.
+     *  \return void
+     */
+    void setDirectDelivery(bool direct);
+
+    /**
+     *  \brief Transport counters of the current connection.
+     *
+     *  Useful to see bytes moved per recv()/send() syscall. All counters
+     *  are zero when there is no connection.
+     *
+     *  \return easywsclient::WebSocket::Stats
+     */
+    easywsclient::WebSocket::Stats getTransportStats();
+
+    /**
+     *  \brief Sets the timeouts used by the next open().
+     *
+     *  \param options Limits for resolving, connecting and the handshake.
+     *  \return void
+     */
+    void setConnectOptions(
+        const easywsclient::WebSocket::ConnectOptions& options);
+
+    /**
+     *  \brief How long each phase of the current connection took.
+     *
+     *  Phases that have not completed read as zero.
+     *
+     *  \return easywsclient::WebSocket::ConnectTimings
+     */
+    easywsclient::WebSocket::ConnectTimings getConnectTimings();
 };
 
 #endif
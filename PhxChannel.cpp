@@ -1,6 +1,9 @@
 #include "PhxChannel.h"
+#include "PhxEnvelope.h"
 #include "PhxPush.h"
 #include "PhxSocket.h"
+#include <cstring>
+#include <iterator>
 
 PhxChannel::PhxChannel(std::shared_ptr<PhxSocket> socket,
     const std::string& topic,
@@ -10,6 +13,11 @@ PhxChannel::PhxChannel(std::shared_ptr<PhxSocket> socket,
     this->params = params;
     this->socket = socket;
     this->joinedOnce = false;
+    this->nextBindingId = 1;
+    this->dispatching = 0;
+    this->sweepPending = false;
+    this->maxPendingReplies = 65536;
+    this->replyStats = ReplyStats();
 }
 
 void PhxChannel::bootstrap() {
@@ -35,7 +43,7 @@ void PhxChannel::bootstrap() {
         [this](nlohmann::json message) { this->state = ChannelState::JOINED; });
 
     this->onEvent("phx_reply", [this](nlohmann::json message, int64_t ref) {
-        this->triggerEvent(this->replyEventName(ref), message, ref);
+        this->resolveReply(ref, message);
     });
 }
 
@@ -58,6 +66,9 @@ void PhxChannel::rejoin() {
 }
 
 void PhxChannel::sendJoin() {
+    // The socket drops its channels when it closes, so a rejoin after a
+    // reconnect has to register again for the reply to be routed here.
+    this->socket->addChannel(this->shared_from_this());
     this->state = ChannelState::JOINING;
     this->joinPush->setPayload(this->params);
     this->joinPush->send();
@@ -84,33 +95,163 @@ void PhxChannel::onError(OnError callback) {
         [callback](nlohmann::json error, int64_t ref) { callback(error); });
 }
 
-void PhxChannel::onEvent(const std::string& event, OnReceive callback) {
-    this->bindings.emplace_back(event, callback);
+PhxChannel::BindingId PhxChannel::onEvent(
+    const std::string& event, OnReceive callback) {
+    return this->addBinding(
+        event, Binding{ 0, std::move(callback), nullptr, false });
+}
+
+PhxChannel::BindingId PhxChannel::onEnvelope(
+    const std::string& event, OnEnvelope callback) {
+    return this->addBinding(
+        event, Binding{ 0, nullptr, std::move(callback), false });
+}
+
+PhxChannel::BindingId PhxChannel::addBinding(
+    const std::string& event, Binding binding) {
+    std::lock_guard<std::mutex> guard(this->bindingsMutex);
+    auto interned = this->eventIds.emplace(event, this->bindings.size());
+    if (interned.second) {
+        this->bindings.emplace_back();
+    }
+
+    size_t eventId = interned.first->second;
+    binding.id = this->nextBindingId++;
+    std::list<Binding>& list = this->bindings[eventId];
+    list.push_back(std::move(binding));
+    this->bindingIds.emplace(
+        list.back().id, std::make_pair(eventId, std::prev(list.end())));
+    return list.back().id;
 }
 
 void PhxChannel::offEvent(const std::string& event) {
     // Remove all Event bindings that match event.
-    std::vector<std::tuple<std::string, OnReceive>> v = this->bindings;
-    v.erase(std::remove_if(v.begin(),
-                v.end(),
-                [this, event](std::tuple<std::string, OnReceive> x) {
-                    return std::get<0>(x) == event;
-                }),
-        v.end());
+    std::lock_guard<std::mutex> guard(this->bindingsMutex);
+    auto interned = this->eventIds.find(event);
+    if (interned == this->eventIds.end()) {
+        return;
+    }
+
+    std::list<Binding>& list = this->bindings[interned->second];
+    for (Binding& binding : list) {
+        this->bindingIds.erase(binding.id);
+        binding.removed = true;
+    }
+
+    if (this->dispatching) {
+        this->sweepPending = true;
+    } else {
+        list.clear();
+    }
+}
+
+void PhxChannel::offEvent(BindingId binding) {
+    std::lock_guard<std::mutex> guard(this->bindingsMutex);
+    auto found = this->bindingIds.find(binding);
+    if (found == this->bindingIds.end()) {
+        return;
+    }
+
+    size_t eventId = found->second.first;
+    std::list<Binding>::iterator position = found->second.second;
+    this->bindingIds.erase(found);
+
+    if (this->dispatching) {
+        // A triggerEvent may be standing on this node; unlink it later.
+        position->removed = true;
+        this->sweepPending = true;
+    } else {
+        this->bindings[eventId].erase(position);
+    }
+}
+
+void PhxChannel::sweepBindings() {
+    for (std::list<Binding>& list : this->bindings) {
+        list.remove_if([](const Binding& binding) { return binding.removed; });
+    }
+    this->sweepPending = false;
 }
 
 bool PhxChannel::isMemberOfTopic(const std::string& topic) {
     return this->topic == topic;
 }
 
+bool PhxChannel::isMember(const PhxEnvelope& envelope) {
+    if (!this->isMemberOfTopic(envelope.getTopic())) {
+        return false;
+    }
+
+    int64_t joinRef = envelope.getJoinRef();
+    if (joinRef < 0 || joinRef == this->getJoinRef()) {
+        return true;
+    }
+
+    static const char* const lifecycleEvents[]
+        = { "phx_close", "phx_error", "phx_join", "phx_reply", "phx_leave" };
+    for (const char* event : lifecycleEvents) {
+        if (std::strcmp(envelope.getEvent().c_str(), event) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int64_t PhxChannel::getJoinRef() {
+    return this->joinedOnce ? this->joinPush->getRef() : -1;
+}
+
 void PhxChannel::triggerEvent(
     const std::string& event, nlohmann::json message, int64_t ref) {
-    // Trigger OnReceive callbacks that match event.
-    std::vector<std::tuple<std::string, OnReceive>> v = this->bindings;
-    for (std::tuple<std::string, OnReceive>& it : v) {
-        if (std::get<0>(it) == event) {
-            std::get<1>(it)(message, ref);
+    this->dispatch(
+        PhxEnvelope(this->topic, event, std::move(message), ref, -1));
+}
+
+void PhxChannel::dispatch(const PhxEnvelope& envelope) {
+    // Trigger callbacks that match the envelope's event.
+    std::unique_lock<std::mutex> lock(this->bindingsMutex);
+    auto interned = this->eventIds.find(envelope.getEvent());
+    if (interned == this->eventIds.end()) {
+        return;
+    }
+
+    std::list<Binding>& list = this->bindings[interned->second];
+    if (list.empty()) {
+        return;
+    }
+
+    // Nodes are not unlinked while dispatching is nonzero, so the walk
+    // can drop the lock around each callback. Stop at the current last
+    // node so bindings added by the callbacks wait for the next event.
+    this->dispatching++;
+    std::list<Binding>::iterator last = std::prev(list.end());
+    std::list<Binding>::iterator it = list.begin();
+    while (true) {
+        if (!it->removed) {
+            const Binding& binding = *it;
+            lock.unlock();
+            try {
+                if (binding.callback) {
+                    binding.callback(envelope.payload(), envelope.getRef());
+                } else {
+                    binding.envelopeCallback(envelope);
+                }
+            } catch (...) {
+                lock.lock();
+                this->dispatching--;
+                throw;
+            }
+            lock.lock();
         }
+
+        if (it == last) {
+            break;
+        }
+        ++it;
+    }
+
+    this->dispatching--;
+    if (this->dispatching == 0 && this->sweepPending) {
+        this->sweepBindings();
     }
 }
 
@@ -127,12 +268,82 @@ std::shared_ptr<PhxSocket> PhxChannel::getSocket() {
     return this->socket;
 }
 
-std::string PhxChannel::replyEventName(int64_t ref) {
-    std::string text = "chan_reply_";
-    text += std::to_string(ref);
-    return text;
+void PhxChannel::awaitReply(int64_t ref, OnReceive callback) {
+    std::lock_guard<std::mutex> guard(this->repliesMutex);
+    if (!this->replies.emplace(ref, std::move(callback)).second) {
+        return;
+    }
+
+    this->replyOrder.push_back(ref);
+    this->replyStats.registered++;
+    this->trimReplies();
+}
+
+void PhxChannel::cancelReply(int64_t ref) {
+    std::lock_guard<std::mutex> guard(this->repliesMutex);
+    if (this->replies.erase(ref)) {
+        this->replyStats.cancelled++;
+    }
+}
+
+void PhxChannel::resolveReply(int64_t ref, nlohmann::json message) {
+    OnReceive callback;
+    {
+        std::lock_guard<std::mutex> guard(this->repliesMutex);
+        auto found = this->replies.find(ref);
+        if (found == this->replies.end()) {
+            this->replyStats.unmatched++;
+            return;
+        }
+
+        callback = std::move(found->second);
+        this->replies.erase(found);
+        this->replyStats.resolved++;
+    }
+
+    callback(message, ref);
+}
+
+void PhxChannel::trimReplies() {
+    while (this->replies.size() > this->maxPendingReplies) {
+        int64_t oldest = this->replyOrder.front();
+        this->replyOrder.pop_front();
+        if (this->replies.erase(oldest)) {
+            this->replyStats.evicted++;
+        }
+    }
+
+    // Replies mostly resolve in order, so stale refs pile up behind a
+    // long-lived head. Compact once they outnumber the live ones.
+    while (!this->replyOrder.empty()
+        && !this->replies.count(this->replyOrder.front())) {
+        this->replyOrder.pop_front();
+    }
+
+    if (this->replyOrder.size() > 2 * this->replies.size() + 64) {
+        std::deque<int64_t> live;
+        for (int64_t ref : this->replyOrder) {
+            if (this->replies.count(ref)) {
+                live.push_back(ref);
+            }
+        }
+        this->replyOrder.swap(live);
+    }
+}
+
+void PhxChannel::setMaxPendingReplies(size_t max) {
+    std::lock_guard<std::mutex> guard(this->repliesMutex);
+    this->maxPendingReplies = max ? max : 1;
+    this->trimReplies();
+}
+
+PhxChannel::ReplyStats PhxChannel::getReplyStats() {
+    std::lock_guard<std::mutex> guard(this->repliesMutex);
+    ReplyStats stats = this->replyStats;
+    stats.pending = this->replies.size();
+    return stats;
 }
 
-std::string PhxChannel::getTopic() {
+const std::string& PhxChannel::getTopic() const {
     return this->topic;
 }
@@ -9,9 +9,14 @@
 #define PhxChannel_H
 
 #include "PhxTypes.h"
+#include <cstdint>
+#include <deque>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class PhxSocket;
@@ -25,12 +30,126 @@ public:
 };
 
 class PhxChannel : public std::enable_shared_from_this<PhxChannel> {
+public:
+    /*!< Identifies a callback added with onEvent. 0 is never used. */
+    typedef uint64_t BindingId;
+
+    /*!< Counters for the table of replies in flight. */
+    struct ReplyStats {
+        /*!< Replies currently awaited. */
+        size_t pending;
+
+        /*!< Replies registered with awaitReply. */
+        uint64_t registered;
+
+        /*!< Replies that arrived and were delivered. */
+        uint64_t resolved;
+
+        /*!< Replies given up on through cancelReply, e.g. on timeout. */
+        uint64_t cancelled;
+
+        /*!< Replies dropped to keep the table within its bound. */
+        uint64_t evicted;
+
+        /*!< Replies that arrived with no matching entry. */
+        uint64_t unmatched;
+    };
+
 private:
+    struct Binding {
+        BindingId id;
+
+        /*!< Called with the parsed payload, unless empty. */
+        OnReceive callback;
+
+        /*!< Called with the envelope itself, used if callback is empty. */
+        OnEnvelope envelopeCallback;
+
+        /*!< Set when removed while the list was being dispatched. */
+        bool removed;
+    };
+
+    /*!<
+     * Callbacks per event. An event name is interned to an index into this
+     * vector the first time it is bound, and entries are never dropped so
+     * indices stay valid.
+     */
+    std::vector<std::list<Binding>> bindings;
+
+    /*!< Interned event names, mapping to an index into bindings. */
+    std::unordered_map<std::string, size_t> eventIds;
+
+    /*!< Every live binding by id, so offEvent by id is O(1). */
+    std::unordered_map<BindingId,
+        std::pair<size_t, std::list<Binding>::iterator>>
+        bindingIds;
+
+    /*!< Source of binding ids. */
+    BindingId nextBindingId;
+
+    /*!<
+     * Number of triggerEvent calls walking bindings. While nonzero, removed
+     * bindings are only marked and are unlinked once the last one returns.
+     */
+    int dispatching;
+
+    /*!< Whether any binding was marked removed during dispatch. */
+    bool sweepPending;
+
+    /*!< Guards the binding tables above. Never held while calling out. */
+    std::mutex bindingsMutex;
+
+    /*!< Callbacks awaiting a phx_reply, keyed by the ref they were sent with. */
+    std::unordered_map<int64_t, OnReceive> replies;
+
     /*!<
-     * bindings contains a list of tuples where Item 1 is the Event
-     * and Item 2 is the callback.
+     * Refs in the order they were registered, for evicting the oldest.
+     * Refs already resolved or cancelled are skipped lazily.
+     */
+    std::deque<int64_t> replyOrder;
+
+    /*!< Most replies awaited at once before the oldest are evicted. */
+    size_t maxPendingReplies;
+
+    /*!< Counters reported by getReplyStats. */
+    ReplyStats replyStats;
+
+    /*!< Guards replies, replyOrder, maxPendingReplies and replyStats. */
+    std::mutex repliesMutex;
+
+    /**
+     *  \brief Delivers a phx_reply to the callback awaiting its ref.
+     *
+     *  \param ref The ref of the reply.
+     *  \param message The reply.
+     *  \return void
+     */
+    void resolveReply(int64_t ref, nlohmann::json message);
+
+    /**
+     *  \brief Evicts the oldest replies beyond maxPendingReplies.
+     *
+     *  Called with repliesMutex held.
+     *
+     *  \return void
+     */
+    void trimReplies();
+
+    /**
+     *  \brief Unlinks bindings marked removed. Called with bindingsMutex held.
+     *
+     *  \return void
+     */
+    void sweepBindings();
+
+    /**
+     *  \brief Adds a binding for event.
+     *
+     *  \param event The event to listen to.
+     *  \param binding The binding, whose id is filled in.
+     *  \return BindingId
      */
-    std::vector<std::tuple<std::string, OnReceive>> bindings;
+    BindingId addBinding(const std::string& event, Binding binding);
 
     /*!< A flag indicating whether there has been an attempt to join channel. */
     bool joinedOnce;
@@ -76,9 +195,31 @@ private:
     bool isMemberOfTopic(const std::string& topic);
 
 public:
+    /**
+     *  \brief Determines if a message is meant for this channel.
+     *
+     *  A message for the topic is dropped if it is a lifecycle event, such
+     *  as phx_reply or phx_close, left over from an earlier join.
+     *
+     *  \param envelope The message.
+     *  \return bool
+     */
+    bool isMember(const PhxEnvelope& envelope);
+
+    /**
+     *  \brief The ref of the current join, sent as join_ref with every push.
+     *
+     *  \return int64_t -1 before the channel is first joined.
+     */
+    int64_t getJoinRef();
+
     /**
      *  \brief Trigger callbacks that match event.
      *
+     *  Callbacks run in the order they were added, without the binding
+     *  lock held. Callbacks added while the event is being triggered are
+     *  not called until the next time.
+     *
      *  \param event The event to trigger callbacks for.
      *  \param message The message to forward to callback.
      *  \param ref The ref of the message.
@@ -87,6 +228,17 @@ public:
     void triggerEvent(
         const std::string& event, nlohmann::json message, int64_t ref);
 
+    /**
+     *  \brief Trigger callbacks that match the event of an envelope.
+     *
+     *  The payload is only parsed if an onEvent callback is bound to the
+     *  event; onEnvelope callbacks decide for themselves.
+     *
+     *  \param envelope The message to dispatch.
+     *  \return void
+     */
+    void dispatch(const PhxEnvelope& envelope);
+
     /**
      *  \brief Getter for socket.
      *
@@ -95,12 +247,40 @@ public:
     std::shared_ptr<PhxSocket> getSocket();
 
     /**
-     *  \brief Creates a event named for a reply using ref.
+     *  \brief Registers a callback for the phx_reply carrying ref.
+     *
+     *  The callback is called at most once and is then forgotten. If more
+     *  than the maximum number of replies are awaited, the oldest entry is
+     *  evicted without being called.
+     *
+     *  \param ref The ref the message was sent with.
+     *  \param callback The callback to trigger with the reply.
+     *  \return void
+     */
+    void awaitReply(int64_t ref, OnReceive callback);
+
+    /**
+     *  \brief Stops waiting for the reply carrying ref.
      *
-     *  \param ref Phoenix ref.
-     *  \return std::string
+     *  \param ref The ref passed to awaitReply.
+     *  \return void
      */
-    std::string replyEventName(int64_t ref);
+    void cancelReply(int64_t ref);
+
+    /**
+     *  \brief Sets how many replies may be awaited at once.
+     *
+     *  \param max The bound, at least 1. Defaults to 65536.
+     *  \return void
+     */
+    void setMaxPendingReplies(size_t max);
+
+    /**
+     *  \brief Counters for the replies this channel has awaited.
+     *
+     *  \return ReplyStats
+     */
+    ReplyStats getReplyStats();
 
     /**
      *  \brief Constructor
@@ -152,9 +332,22 @@ public:
      *
      *  \param event The event to listen to.
      *  \param callback The callback to trigger if event is posted.
-     *  \return void
+     *  \return BindingId Handle that can be passed to offEvent.
      */
-    void onEvent(const std::string& event, OnReceive callback);
+    BindingId onEvent(const std::string& event, OnReceive callback);
+
+    /**
+     *  \brief Adds a callback that receives the unparsed message.
+     *
+     *  Use this for events whose handlers only look at the routing fields
+     *  or want to parse the payload themselves; the payload is then never
+     *  parsed unless the callback calls PhxEnvelope::payload().
+     *
+     *  \param event The event to listen to.
+     *  \param callback The callback to trigger if event is posted.
+     *  \return BindingId Handle that can be passed to offEvent.
+     */
+    BindingId onEnvelope(const std::string& event, OnEnvelope callback);
 
     /**
      *  \brief Removes event from this->bindings.
@@ -167,6 +360,17 @@ public:
      */
     void offEvent(const std::string& event);
 
+    /**
+     *  \brief Removes a single callback added with onEvent.
+     *
+     *  This is O(1) and is safe to call from inside a callback, including
+     *  the one being removed.
+     *
+     *  \param binding The handle returned by onEvent.
+     *  \return void
+     */
+    void offEvent(BindingId binding);
+
     /**
      *  \brief Adds a callback that will get triggered on close.
      *
@@ -196,9 +400,12 @@ public:
     /**
      *  \brief Gets the topic of the channel.
      *
-     *  \return std::string topic
+     *  The topic never changes, so the reference stays valid for the
+     *  lifetime of the channel.
+     *
+     *  \return const std::string& topic
      */
-    std::string getTopic();
+    const std::string& getTopic() const;
 };
 
 #endif
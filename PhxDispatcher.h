@@ -0,0 +1,34 @@
+/**
+ *   \file PhxDispatcher.h
+ *   \brief Interface for running channel callbacks off the socket's queue.
+ *
+ *  By default PhxSocket runs every channel callback on its one serial
+ *  queue. Given a PhxDispatcher, it hands each message to the dispatcher
+ *  keyed by its topic instead, so channels on different topics can be
+ *  handled in parallel while each topic still sees its messages in order.
+ */
+#ifndef PhxDispatcher_H
+#define PhxDispatcher_H
+
+#include "PhxTask.h"
+#include <cstddef>
+
+class PhxDispatcher {
+public:
+    virtual ~PhxDispatcher() {
+    }
+
+    /**
+     *  \brief Runs a task on the dispatcher's threads.
+     *
+     *  Tasks with the same key run one at a time in the order they were
+     *  dispatched. Tasks with different keys may run in parallel.
+     *
+     *  \param key The ordering key, such as a hash of the topic.
+     *  \param task The task to run.
+     *  \return void
+     */
+    virtual void dispatch(size_t key, PhxTask task) = 0;
+};
+
+#endif
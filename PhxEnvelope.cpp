@@ -0,0 +1,309 @@
+#include "PhxEnvelope.h"
+#include "PhxStructuralIndex.h"
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+size_t skipSpace(const std::string& s, size_t pos) {
+    while (pos < s.size() && isSpace(s[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+// Returns the index entry just past the object or array opened at entry i,
+// or npos if it is not closed. Quotes come in pairs and strings hold no
+// entries, so only brackets need counting.
+size_t skipNested(const std::string& s, const std::vector<uint32_t>& index,
+    size_t i) {
+    int depth = 0;
+    for (; i < index.size(); i++) {
+        char c = s[index[i]];
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                return i + 1;
+            }
+        }
+    }
+    return std::string::npos;
+}
+
+// Finds the value starting after offset from, where index entry i is the
+// first structural past from. Returns the index entry just past the value,
+// or npos if there is no value.
+size_t scanValue(const std::string& s, const std::vector<uint32_t>& index,
+    size_t i, size_t from, size_t& begin, size_t& end) {
+    if (i >= index.size()) {
+        return std::string::npos;
+    }
+
+    begin = skipSpace(s, from);
+    if (begin != index[i]) {
+        // A number or a literal runs until the next structural.
+        end = index[i];
+        while (end > begin && isSpace(s[end - 1])) {
+            end--;
+        }
+        return i;
+    }
+
+    char c = s[begin];
+    if (c == '"' && i + 1 < index.size()) {
+        end = index[i + 1] + 1;
+        return i + 2;
+    }
+
+    if (c == '{' || c == '[') {
+        i = skipNested(s, index, i);
+        if (i != std::string::npos) {
+            end = index[i - 1] + 1;
+        }
+        return i;
+    }
+
+    return std::string::npos;
+}
+
+bool keyIs(const std::string& s, size_t begin, size_t end, const char* key) {
+    size_t len = std::strlen(key);
+    return end - begin == len && s.compare(begin, len, key) == 0;
+}
+
+// Decodes the string value in [begin, end), quotes included.
+bool decodeString(const std::string& s, size_t begin, size_t end,
+    std::string& out) {
+    if (s[begin] != '"') {
+        return false;
+    }
+
+    if (std::memchr(&s[begin], '\\', end - begin) == nullptr) {
+        out.assign(s, begin + 1, end - begin - 2);
+        return true;
+    }
+
+    // Escapes are rare in topics and events; let the json parser do them.
+    // Scanning may run on an I/O thread, so a bad escape must not throw.
+    try {
+        out = nlohmann::json::parse(s.begin() + begin, s.begin() + end)
+                  .get<std::string>();
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// Phoenix sends refs as numbers or as numeric strings.
+int64_t decodeRef(const std::string& s, size_t begin, size_t end) {
+    if (s[begin] == '"') {
+        begin++;
+        end--;
+    }
+
+    if (end <= begin || keyIs(s, begin, end, "null")) {
+        return -1;
+    }
+
+    return std::strtoll(s.c_str() + begin, nullptr, 10);
+}
+
+} // namespace
+
+PhxEnvelope::PhxEnvelope() {
+    this->ref = -1;
+    this->joinRef = -1;
+    this->payloadBegin = 0;
+    this->payloadEnd = 0;
+    this->parsed = false;
+}
+
+PhxEnvelope::PhxEnvelope(const std::string& topic,
+    const std::string& event,
+    nlohmann::json payload,
+    int64_t ref,
+    int64_t joinRef) {
+    this->topic = topic;
+    this->event = event;
+    this->ref = ref;
+    this->joinRef = joinRef;
+    this->payloadBegin = 0;
+    this->payloadEnd = 0;
+    this->parsed = true;
+    this->parsedPayload = std::move(payload);
+}
+
+bool PhxEnvelope::scan(std::string frame) {
+    this->raw = std::move(frame);
+    this->topic.clear();
+    this->event.clear();
+    this->ref = -1;
+    this->joinRef = -1;
+    this->payloadBegin = this->payloadEnd = 0;
+    this->parsed = false;
+    this->parsedPayload = nullptr;
+
+    const std::string& s = this->raw;
+    if (s.size() >= std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+
+    // Reused across frames so steady traffic does not allocate.
+    static thread_local std::vector<uint32_t> index;
+    if (!PhxStructuralIndex::build(s.data(), s.size(), index)) {
+        return false;
+    }
+
+    if (index.empty() || skipSpace(s, 0) != index[0]) {
+        return false;
+    }
+
+    if (s[index[0]] == '[') {
+        return this->scanArray(index);
+    }
+
+    if (s[index[0]] == '{') {
+        return this->scanObject(index);
+    }
+
+    return false;
+}
+
+bool PhxEnvelope::scanObject(const std::vector<uint32_t>& index) {
+    const std::string& s = this->raw;
+    size_t count = index.size();
+    bool hasTopic = false;
+    bool hasEvent = false;
+    size_t i = 1;
+    // Each member is a key's two quotes and a colon, then its value.
+    while (i + 3 < count) {
+        if (s[index[i]] != '"' || s[index[i + 2]] != ':') {
+            return false;
+        }
+
+        size_t keyBegin = index[i] + 1;
+        size_t keyEnd = index[i + 1];
+        size_t valueBegin;
+        size_t valueEnd;
+        i = scanValue(
+            s, index, i + 3, index[i + 2] + 1, valueBegin, valueEnd);
+        if (i == std::string::npos) {
+            return false;
+        }
+
+        if (keyIs(s, keyBegin, keyEnd, "topic")) {
+            hasTopic = decodeString(s, valueBegin, valueEnd, this->topic);
+        } else if (keyIs(s, keyBegin, keyEnd, "event")) {
+            hasEvent = decodeString(s, valueBegin, valueEnd, this->event);
+        } else if (keyIs(s, keyBegin, keyEnd, "ref")) {
+            this->ref = decodeRef(s, valueBegin, valueEnd);
+        } else if (keyIs(s, keyBegin, keyEnd, "join_ref")) {
+            this->joinRef = decodeRef(s, valueBegin, valueEnd);
+        } else if (keyIs(s, keyBegin, keyEnd, "payload")) {
+            this->payloadBegin = valueBegin;
+            this->payloadEnd = valueEnd;
+        }
+
+        if (i >= count) {
+            return false;
+        }
+
+        char c = s[index[i]];
+        if (c == '}') {
+            return hasTopic && hasEvent;
+        }
+
+        if (c != ',') {
+            return false;
+        }
+        i++;
+    }
+
+    return false;
+}
+
+bool PhxEnvelope::scanArray(const std::vector<uint32_t>& index) {
+    const std::string& s = this->raw;
+    size_t count = index.size();
+    size_t begin[5];
+    size_t end[5];
+    size_t i = 1;
+    // [join_ref, ref, topic, event, payload]
+    for (int field = 0; field < 5; field++) {
+        i = scanValue(s, index, i, index[i - 1] + 1, begin[field], end[field]);
+        if (i == std::string::npos || i >= count
+            || s[index[i]] != (field == 4 ? ']' : ',')) {
+            return false;
+        }
+        i++;
+    }
+
+    this->joinRef = decodeRef(s, begin[0], end[0]);
+    this->ref = decodeRef(s, begin[1], end[1]);
+    this->payloadBegin = begin[4];
+    this->payloadEnd = end[4];
+    return decodeString(s, begin[2], end[2], this->topic)
+        && decodeString(s, begin[3], end[3], this->event);
+}
+
+const std::string& PhxEnvelope::getTopic() const {
+    return this->topic;
+}
+
+const std::string& PhxEnvelope::getEvent() const {
+    return this->event;
+}
+
+int64_t PhxEnvelope::getRef() const {
+    return this->ref;
+}
+
+int64_t PhxEnvelope::getJoinRef() const {
+    return this->joinRef;
+}
+
+std::string PhxEnvelope::rawPayload() const {
+    return this->raw.substr(
+        this->payloadBegin, this->payloadEnd - this->payloadBegin);
+}
+
+const nlohmann::json& PhxEnvelope::payload() const {
+    if (!this->parsed) {
+        if (this->payloadEnd > this->payloadBegin) {
+            this->parsedPayload = nlohmann::json::parse(
+                this->raw.begin() + this->payloadBegin,
+                this->raw.begin() + this->payloadEnd);
+        }
+        this->parsed = true;
+    }
+    return this->parsedPayload;
+}
+
+nlohmann::json PhxEnvelope::toJson() const {
+    size_t start = skipSpace(this->raw, 0);
+    if (start < this->raw.size() && this->raw[start] == '{') {
+        return nlohmann::json::parse(this->raw);
+    }
+
+    // clang-format off
+    nlohmann::json json = {
+        { "topic", this->topic },
+        { "event", this->event },
+        { "payload", this->payload() },
+        { "ref", this->ref < 0 ? nlohmann::json(nullptr)
+                               : nlohmann::json(this->ref) }
+    };
+    // clang-format on
+    if (this->joinRef >= 0) {
+        json["join_ref"] = this->joinRef;
+    }
+    return json;
+}
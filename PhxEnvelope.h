@@ -0,0 +1,160 @@
+/**
+ *   \file PhxEnvelope.h
+ *   \brief A Phoenix message whose payload is only parsed when needed.
+ *
+ *  Routing a message only needs its topic, event and ref. PhxEnvelope
+ *  scans a raw frame for those fields without building a json DOM and
+ *  keeps the payload as a slice of the frame. The payload is parsed the
+ *  first time payload() is called, so messages that nobody looks at, or
+ *  whose handlers only need the routing fields, never pay for it.
+ *
+ *  Both Phoenix wire formats are understood: the 1.0.0 object,
+ *  {"topic": ..., "event": ..., "payload": ..., "ref": ..., "join_ref": ...},
+ *  and the 2.0.0 array, [join_ref, ref, topic, event, payload].
+ *
+ *  An envelope is meant to be dispatched on one thread at a time; the
+ *  lazily parsed payload is cached without locking.
+ */
+#ifndef PhxEnvelope_H
+#define PhxEnvelope_H
+
+#include "json.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class PhxEnvelope {
+private:
+    /*!< The frame the envelope was scanned from, empty if built directly. */
+    std::string raw;
+
+    /*!< The topic of the message. */
+    std::string topic;
+
+    /*!< The event of the message. */
+    std::string event;
+
+    /*!< The ref of the message, -1 when null or absent. */
+    int64_t ref;
+
+    /*!< The ref of the join the message belongs to, -1 when absent. */
+    int64_t joinRef;
+
+    /*!< Where the payload starts in raw. */
+    size_t payloadBegin;
+
+    /*!< Where the payload ends in raw, equal to payloadBegin if absent. */
+    size_t payloadEnd;
+
+    /*!< Whether parsedPayload holds the payload. */
+    mutable bool parsed;
+
+    /*!< The payload once parsed. */
+    mutable nlohmann::json parsedPayload;
+
+    /**
+     *  \brief Scans raw as an object message.
+     *
+     *  \param index The structural index of raw.
+     *  \return bool
+     */
+    bool scanObject(const std::vector<uint32_t>& index);
+
+    /**
+     *  \brief Scans raw as an array message.
+     *
+     *  \param index The structural index of raw.
+     *  \return bool
+     */
+    bool scanArray(const std::vector<uint32_t>& index);
+
+public:
+    /**
+     *  \brief Constructor for an empty envelope to scan() into.
+     *
+     *  \return PhxEnvelope
+     */
+    PhxEnvelope();
+
+    /**
+     *  \brief Constructor for an envelope built from parsed values.
+     *
+     *  \param topic The topic of the message.
+     *  \param event The event of the message.
+     *  \param payload The payload of the message.
+     *  \param ref The ref of the message.
+     *  \param joinRef The ref of the join the message belongs to.
+     *  \return PhxEnvelope
+     */
+    PhxEnvelope(const std::string& topic,
+        const std::string& event,
+        nlohmann::json payload,
+        int64_t ref,
+        int64_t joinRef);
+
+    /**
+     *  \brief Scans a frame into this envelope.
+     *
+     *  The frame may be in either wire format. Only the top level of the
+     *  frame is scanned. The payload is not
+     *  validated until payload() parses it. Never throws, so frames may be
+     *  scanned on the thread that received them.
+     *
+     *  \param frame The frame, which the envelope takes ownership of.
+     *  \return bool false if the frame is not a Phoenix message.
+     */
+    bool scan(std::string frame);
+
+    /**
+     *  \brief The topic of the message.
+     *
+     *  \return const std::string&
+     */
+    const std::string& getTopic() const;
+
+    /**
+     *  \brief The event of the message.
+     *
+     *  \return const std::string&
+     */
+    const std::string& getEvent() const;
+
+    /**
+     *  \brief The ref of the message, -1 if it has none.
+     *
+     *  \return int64_t
+     */
+    int64_t getRef() const;
+
+    /**
+     *  \brief The ref of the join the message belongs to, -1 if it has none.
+     *
+     *  \return int64_t
+     */
+    int64_t getJoinRef() const;
+
+    /**
+     *  \brief The unparsed payload text.
+     *
+     *  Empty for envelopes built from parsed values.
+     *
+     *  \return std::string
+     */
+    std::string rawPayload() const;
+
+    /**
+     *  \brief The payload, parsed on first use.
+     *
+     *  \return const nlohmann::json& null if the message had no payload.
+     */
+    const nlohmann::json& payload() const;
+
+    /**
+     *  \brief The whole message as json.
+     *
+     *  \return nlohmann::json
+     */
+    nlohmann::json toJson() const;
+};
+
+#endif
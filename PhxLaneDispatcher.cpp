@@ -0,0 +1,41 @@
+#include "PhxLaneDispatcher.h"
+#include <thread>
+
+PhxLaneDispatcher::PhxLaneDispatcher(size_t lanes, size_t capacity) {
+    if (lanes == 0) {
+        lanes = std::thread::hardware_concurrency();
+    }
+    if (lanes == 0) {
+        lanes = 1;
+    }
+
+    for (size_t i = 0; i < lanes; i++) {
+        this->lanes.emplace_back(new PhxSerialQueue(capacity, true));
+    }
+}
+
+PhxLaneDispatcher::~PhxLaneDispatcher() {
+    // Each lane drains and joins as it is destroyed.
+    this->lanes.clear();
+}
+
+void PhxLaneDispatcher::dispatch(size_t key, PhxTask task) {
+    this->lanes[this->laneFor(key)]->post(std::move(task));
+}
+
+size_t PhxLaneDispatcher::laneCount() const {
+    return this->lanes.size();
+}
+
+size_t PhxLaneDispatcher::laneFor(size_t key) const {
+    return key % this->lanes.size();
+}
+
+std::vector<PhxSerialQueue::Stats> PhxLaneDispatcher::getLaneStats() const {
+    std::vector<PhxSerialQueue::Stats> stats;
+    stats.reserve(this->lanes.size());
+    for (const std::unique_ptr<PhxSerialQueue>& lane : this->lanes) {
+        stats.push_back(lane->getStats());
+    }
+    return stats;
+}
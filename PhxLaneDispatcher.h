@@ -0,0 +1,68 @@
+/**
+ *   \file PhxLaneDispatcher.h
+ *   \brief A PhxDispatcher running each key on one of a fixed set of lanes.
+ *
+ *  A lane is a PhxSerialQueue with its own thread. Every key maps to one
+ *  lane, so a topic's messages run strictly in order on the same thread,
+ *  while topics on different lanes run in parallel. Unlike
+ *  PhxWorkStealingDispatcher, a slow topic holds up the others sharing its
+ *  lane; in return, dispatching is a single lock-free push and each lane's
+ *  backlog and queueing delay can be watched through getLaneStats().
+ */
+#ifndef PhxLaneDispatcher_H
+#define PhxLaneDispatcher_H
+
+#include "PhxDispatcher.h"
+#include "PhxSerialQueue.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class PhxLaneDispatcher : public PhxDispatcher {
+private:
+    /*!< The lanes, each with its own thread. */
+    std::vector<std::unique_ptr<PhxSerialQueue>> lanes;
+
+public:
+    /**
+     *  \brief Constructor
+     *
+     *  \param lanes Number of lanes, 0 for one per core.
+     *  \param capacity Ring slots per lane, see PhxSerialQueue.
+     *  \return PhxLaneDispatcher
+     */
+    explicit PhxLaneDispatcher(size_t lanes = 0, size_t capacity = 1024);
+
+    /**
+     *  \brief Destructor
+     *
+     *  Runs the tasks already dispatched, then joins the lanes' threads.
+     */
+    ~PhxLaneDispatcher();
+
+    void dispatch(size_t key, PhxTask task);
+
+    /**
+     *  \brief Number of lanes.
+     *
+     *  \return size_t
+     */
+    size_t laneCount() const;
+
+    /**
+     *  \brief The lane a key's tasks run on.
+     *
+     *  \param key The key.
+     *  \return size_t Index into getLaneStats().
+     */
+    size_t laneFor(size_t key) const;
+
+    /**
+     *  \brief Queue depth and wait times of every lane, by index.
+     *
+     *  \return std::vector<PhxSerialQueue::Stats>
+     */
+    std::vector<PhxSerialQueue::Stats> getLaneStats() const;
+};
+
+#endif
@@ -3,8 +3,6 @@
 #include "PhxSocket.h"
 #include <algorithm>
 #include <chrono>
-#include <future>
-#include <thread>
 
 PhxPush::PhxPush(std::shared_ptr<PhxChannel> channel,
     const std::string& event,
@@ -13,37 +11,50 @@ PhxPush::PhxPush(std::shared_ptr<PhxChannel> channel,
     this->event = event;
     this->payload = payload;
 
+    this->ref = -1;
     this->receivedResp = nullptr;
     this->afterHook = nullptr;
     this->sent = false;
+    this->resolved = false;
 }
 
 void PhxPush::send() {
     int64_t ref = this->channel->getSocket()->makeRef();
-    this->refEvent = this->channel->replyEventName(ref);
+    // A resend (e.g. a rejoin) no longer cares about the previous reply
+    // or timeout; the timer goes before resolved is reset so it cannot
+    // claim this send.
+    this->cancelRefEvent();
+    this->cancelAfter();
+    this->ref = ref;
     this->receivedResp = nullptr;
     this->sent = false;
-
-    // FIXME: Should this be weak?
-    this->channel->onEvent(
-        this->refEvent, [this](nlohmann::json message, int64_t ref) {
-            this->receivedResp = message;
-            this->matchReceive(message);
-            this->cancelRefEvent();
-            this->cancelAfter();
+    this->resolved = false;
+
+    // The table holds the push alive until its reply arrives, it times
+    // out or it is evicted, so callers may drop their reference.
+    std::shared_ptr<PhxPush> self = this->shared_from_this();
+    this->channel->awaitReply(
+        ref, [self](nlohmann::json message, int64_t ref) {
+            // Claim the outcome before running any hook, so a timeout
+            // firing meanwhile cannot run its hook as well.
+            if (self->resolved.exchange(true)) {
+                return;
+            }
+            self->cancelAfter();
+            self->receivedResp = message;
+            self->matchReceive(message);
         });
 
     this->startAfter();
     this->sent = true;
 
-    // clang-format off
-    this->channel->getSocket()->push(
-        { { "topic", this->channel->getTopic() },
-          { "event", this->event },
-          { "payload", this->payload },
-          { "ref", ref }
-        });
-    // clang-format on
+    // For the join push itself this is the ref just taken above.
+    this->channel->getSocket()->push(this->channel->getTopic(), this->event,
+        this->payload, ref, this->channel->getJoinRef());
+}
+
+int64_t PhxPush::getRef() const {
+    return this->ref;
 }
 
 std::shared_ptr<PhxPush> PhxPush::onReceive(
@@ -69,20 +80,16 @@ std::shared_ptr<PhxPush> PhxPush::after(int ms, After callback) {
 }
 
 void PhxPush::cancelRefEvent() {
-    this->channel->offEvent(this->refEvent);
+    if (this->ref >= 0) {
+        this->channel->cancelReply(this->ref);
+    }
 }
 
 void PhxPush::cancelAfter() {
-    if (!this->afterHook) {
-        return;
+    PhxTimerWheel::TimerId timer = this->afterTimer.exchange(0);
+    if (timer) {
+        PhxTimerWheel::shared().cancel(timer);
     }
-
-    std::thread thread([this]() {
-        std::lock_guard<std::mutex> guard(this->afterTimerMutex);
-        this->shouldContinueAfterCallback = false;
-    });
-
-    thread.detach();
 }
 
 void PhxPush::startAfter() {
@@ -90,21 +97,19 @@ void PhxPush::startAfter() {
         return;
     }
 
-    // FIXME: Should this be weak?
-    int interval = this->afterInterval;
-    std::thread thread([this, interval]() {
-        // Use sleep_for to wait specified time (or sleep_until).
-        this->shouldContinueAfterCallback = true;
-        std::this_thread::sleep_for(std::chrono::seconds{ interval });
-        std::lock_guard<std::mutex> guard(this->afterTimerMutex);
-        if (this->shouldContinueAfterCallback) {
-            this->cancelRefEvent();
-            this->afterHook();
-            this->shouldContinueAfterCallback = false;
-        }
-    });
-
-    thread.detach();
+    this->cancelAfter();
+
+    std::weak_ptr<PhxPush> weak = this->shared_from_this();
+    this->afterTimer = PhxTimerWheel::shared().schedule(
+        std::chrono::seconds{ this->afterInterval }, [weak]() {
+            std::shared_ptr<PhxPush> push = weak.lock();
+            // Whoever sets resolved first wins against a late reply.
+            if (push && !push->resolved.exchange(true)) {
+                push->afterTimer = 0;
+                push->cancelRefEvent();
+                push->afterHook();
+            }
+        });
 }
 
 void PhxPush::matchReceive(nlohmann::json payload) {
@@ -9,10 +9,11 @@
 
 #ifndef PhxPush_H
 #define PhxPush_H
+#include "PhxTimerWheel.h"
 #include "PhxTypes.h"
+#include <atomic>
 #include <map>
 #include <memory>
-#include <mutex>
 #include <string>
 #include <vector>
 
@@ -26,8 +27,11 @@ private:
     /*!< The event name the server listens on. */
     std::string event;
 
-    /*!< Name of event for the message. */
-    std::string refEvent;
+    /*!<
+     * The ref of the last send, -1 before the first. Socket refs start at
+     * 0, so 0 is a real ref.
+     */
+    std::atomic<int64_t> ref;
 
     /*!< Holds the payload that will be sent to the server. */
     nlohmann::json payload;
@@ -51,14 +55,17 @@ private:
      */
     bool sent;
 
-    /*!< Mutex used when setting this->shouldContinueAfterCallback. */
-    std::mutex afterTimerMutex;
+    /*!< The pending After timer, 0 once it fired or was cancelled. */
+    std::atomic<PhxTimerWheel::TimerId> afterTimer{ 0 };
 
-    /*!< Flag that determines if After callback will be triggered. */
-    bool shouldContinueAfterCallback;
+    /*!<
+     * Set by whichever of the reply and the After timer comes first for
+     * the last send; only that one runs its hooks.
+     */
+    std::atomic<bool> resolved;
 
     /**
-     *  \brief Stops listening for this event.
+     *  \brief Stops waiting for the reply to the last send.
      *
      *  \return void
      */
@@ -115,6 +122,13 @@ public:
      */
     void send();
 
+    /**
+     *  \brief The ref of the last send.
+     *
+     *  \return int64_t -1 before the first send.
+     */
+    int64_t getRef() const;
+
     /**
      *  \brief Adds a callback to be triggered for status.
      *
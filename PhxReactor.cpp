@@ -0,0 +1,236 @@
+#include "PhxReactor.h"
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#define MAX_EVENTS 64
+
+PhxReactor::PhxReactor(size_t threads)
+    : nextId(1)
+    , stop(false) {
+#ifdef __linux__
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        std::unique_ptr<Loop> loop(new Loop());
+        loop->running = 0;
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epfd < 0 || loop->wakefd < 0) {
+            throw std::runtime_error("PhxReactor: unable to create epoll");
+        }
+
+        // Registration 0 is reserved for the wakeup descriptor.
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev);
+        this->loops.emplace_back(std::move(loop));
+    }
+
+    for (std::unique_ptr<Loop>& loop : this->loops) {
+        Loop* l = loop.get();
+        l->thread = std::thread([this, l]() { this->run(*l); });
+    }
+#else
+    throw std::runtime_error("PhxReactor requires epoll");
+#endif
+}
+
+PhxReactor::~PhxReactor() {
+#ifdef __linux__
+    this->stop = true;
+    for (std::unique_ptr<Loop>& loop : this->loops) {
+        uint64_t one = 1;
+        ssize_t ret = ::write(loop->wakefd, &one, sizeof(one));
+        (void)ret;
+    }
+
+    for (std::unique_ptr<Loop>& loop : this->loops) {
+        loop->thread.join();
+        ::close(loop->epfd);
+        ::close(loop->wakefd);
+    }
+#endif
+}
+
+PhxReactor::Loop& PhxReactor::loopFor(Registration reg) {
+    return *this->loops.at(reg % this->loops.size());
+}
+
+PhxReactor::Registration PhxReactor::attach(Handler handler) {
+    Registration reg;
+    {
+        std::lock_guard<std::mutex> guard(this->idMutex);
+        reg = this->nextId++;
+    }
+
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->handler = std::move(handler);
+    entry->fd = -1;
+    entry->queued = false;
+
+    Loop& loop = this->loopFor(reg);
+    std::lock_guard<std::mutex> guard(loop.mutex);
+    loop.entries[reg] = std::move(entry);
+    return reg;
+}
+
+void PhxReactor::watch(Registration reg, int fd) {
+#ifdef __linux__
+    Loop& loop = this->loopFor(reg);
+    std::lock_guard<std::mutex> guard(loop.mutex);
+    auto it = loop.entries.find(reg);
+    if (it == loop.entries.end()) {
+        return;
+    }
+
+    std::shared_ptr<Entry>& entry = it->second;
+    if (entry->fd == fd) {
+        return;
+    }
+
+    if (entry->fd >= 0) {
+        // Fails harmlessly if the descriptor was already closed.
+        epoll_ctl(loop.epfd, EPOLL_CTL_DEL, entry->fd, nullptr);
+    }
+
+    entry->fd = fd;
+    if (fd >= 0) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = reg;
+        epoll_ctl(loop.epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+#endif
+}
+
+void PhxReactor::notify(Registration reg) {
+#ifdef __linux__
+    Loop& loop = this->loopFor(reg);
+    {
+        std::lock_guard<std::mutex> guard(loop.mutex);
+        auto it = loop.entries.find(reg);
+        if (it == loop.entries.end() || it->second->queued) {
+            return;
+        }
+
+        it->second->queued = true;
+        loop.notified.push_back(reg);
+    }
+
+    uint64_t one = 1;
+    ssize_t ret = ::write(loop.wakefd, &one, sizeof(one));
+    (void)ret;
+#endif
+}
+
+void PhxReactor::execute(uint64_t key, Handler task) {
+#ifdef __linux__
+    Loop& loop = *this->loops[key % this->loops.size()];
+    {
+        std::lock_guard<std::mutex> guard(loop.mutex);
+        loop.tasks.push_back(std::move(task));
+    }
+
+    uint64_t one = 1;
+    ssize_t ret = ::write(loop.wakefd, &one, sizeof(one));
+    (void)ret;
+#endif
+}
+
+void PhxReactor::detach(Registration reg) {
+#ifdef __linux__
+    Loop& loop = this->loopFor(reg);
+    std::unique_lock<std::mutex> lock(loop.mutex);
+    auto it = loop.entries.find(reg);
+    if (it != loop.entries.end()) {
+        if (it->second->fd >= 0) {
+            epoll_ctl(loop.epfd, EPOLL_CTL_DEL, it->second->fd, nullptr);
+        }
+        loop.entries.erase(it);
+    }
+
+    // Detaching from inside the handler must not wait on itself.
+    if (std::this_thread::get_id() != loop.thread.get_id()) {
+        loop.idle.wait(lock, [&loop, reg]() { return loop.running != reg; });
+    }
+#endif
+}
+
+void PhxReactor::run(Loop& loop) {
+#ifdef __linux__
+    struct epoll_event events[MAX_EVENTS];
+    std::vector<Registration> ready;
+    std::vector<Handler> tasks;
+
+    while (!this->stop) {
+        int n = epoll_wait(loop.epfd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+
+        ready.clear();
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == 0) {
+                uint64_t drained;
+                while (::read(loop.wakefd, &drained, sizeof(drained)) > 0) {
+                }
+            } else {
+                ready.push_back(events[i].data.u64);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(loop.mutex);
+            for (Registration reg : loop.notified) {
+                auto it = loop.entries.find(reg);
+                if (it != loop.entries.end()) {
+                    it->second->queued = false;
+                }
+                ready.push_back(reg);
+            }
+            loop.notified.clear();
+            tasks.swap(loop.tasks);
+        }
+
+        // A socket can be both notified and ready, only service it once.
+        std::sort(ready.begin(), ready.end());
+        ready.erase(std::unique(ready.begin(), ready.end()), ready.end());
+
+        for (Registration reg : ready) {
+            std::shared_ptr<Entry> entry;
+            {
+                std::lock_guard<std::mutex> guard(loop.mutex);
+                auto it = loop.entries.find(reg);
+                if (it == loop.entries.end()) {
+                    continue;
+                }
+                entry = it->second;
+                loop.running = reg;
+            }
+
+            entry->handler();
+
+            {
+                std::lock_guard<std::mutex> guard(loop.mutex);
+                loop.running = 0;
+            }
+            loop.idle.notify_all();
+        }
+
+        for (Handler& task : tasks) {
+            task();
+        }
+        tasks.clear();
+    }
+#endif
+}
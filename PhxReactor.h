@@ -0,0 +1,188 @@
+/**
+ *   \file PhxReactor.h
+ *   \brief A shared epoll reactor that services many sockets on a few threads.
+ *
+ *  Every EasySocket normally owns a worker thread that blocks on its own
+ *  descriptor. PhxReactor lets any number of sockets share one or more I/O
+ *  threads instead: each socket attaches a handler, tells the reactor which
+ *  descriptor to watch, and the handler is run on the owning I/O thread
+ *  whenever that descriptor becomes ready or the socket asks to be notified.
+ *
+ *  Descriptors are watched edge-triggered for both reading and writing, so
+ *  handlers must drain reads and flush writes until they would block.
+ *
+ *  The I/O threads also run tasks handed to execute(), which is how a
+ *  PhxSerialQueue built on a reactor runs without a thread of its own.
+ *
+ *  The reactor is backed by epoll and is only available on Linux.
+ */
+#ifndef PhxReactor_H
+#define PhxReactor_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class PhxReactor {
+public:
+    /*!< Identifies a handler attached to the reactor. 0 is never used. */
+    typedef uint64_t Registration;
+
+    /*!< Called on the I/O thread when the attached socket needs service. */
+    using Handler = std::function<void()>;
+
+private:
+    struct Entry {
+        /*!< The handler to run when the entry is ready. */
+        Handler handler;
+
+        /*!< The descriptor currently watched, -1 if none. */
+        int fd;
+
+        /*!< Whether the entry is already waiting in Loop::notified. */
+        bool queued;
+    };
+
+    struct Loop {
+        /*!< The epoll instance backing this loop. */
+        int epfd;
+
+        /*!< eventfd used to wake the loop for notify() and shutdown. */
+        int wakefd;
+
+        /*!< The I/O thread running this loop. */
+        std::thread thread;
+
+        /*!< Guards entries, notified, tasks and running. */
+        std::mutex mutex;
+
+        /*!< Signalled whenever a handler finishes running. */
+        std::condition_variable idle;
+
+        /*!< Handlers owned by this loop. */
+        std::unordered_map<Registration, std::shared_ptr<Entry>> entries;
+
+        /*!< Registrations notified since the loop last woke up. */
+        std::vector<Registration> notified;
+
+        /*!< Tasks handed over by execute() and not yet run. */
+        std::vector<Handler> tasks;
+
+        /*!< The registration whose handler is running, 0 if none. */
+        Registration running;
+    };
+
+    /*!< The loops, one per I/O thread. */
+    std::vector<std::unique_ptr<Loop>> loops;
+
+    /*!< Source of registration ids. */
+    Registration nextId;
+
+    /*!< Guards nextId. */
+    std::mutex idMutex;
+
+    /*!< Flag telling the I/O threads to exit. */
+    std::atomic<bool> stop;
+
+    /**
+     *  \brief Finds the loop that owns a registration.
+     *
+     *  \param reg The registration.
+     *  \return Loop&
+     */
+    Loop& loopFor(Registration reg);
+
+    /**
+     *  \brief Body of an I/O thread.
+     *
+     *  \param loop The loop to run.
+     *  \return void
+     */
+    void run(Loop& loop);
+
+public:
+    /**
+     *  \brief Constructor
+     *
+     *  \param threads The number of I/O threads to spread sockets over.
+     *  \return PhxReactor
+     */
+    explicit PhxReactor(size_t threads = 1);
+
+    /**
+     *  \brief Stops and joins all I/O threads.
+     */
+    ~PhxReactor();
+
+    PhxReactor(const PhxReactor&) = delete;
+    PhxReactor& operator=(const PhxReactor&) = delete;
+
+    /**
+     *  \brief Attaches a handler to the reactor.
+     *
+     *  Registrations are spread round-robin over the I/O threads. A handler
+     *  always runs on the same thread and never concurrently with itself.
+     *
+     *  \param handler The handler to run when the socket needs service.
+     *  \return Registration
+     */
+    Registration attach(Handler handler);
+
+    /**
+     *  \brief Sets the descriptor watched for a registration.
+     *
+     *  Any previously watched descriptor is removed first. A watched
+     *  descriptor must only be closed on the handler's own thread: closed
+     *  elsewhere, its number could be reused by another socket on this
+     *  loop before it is removed, and that socket's watch removed instead.
+     *
+     *  \param reg The registration.
+     *  \param fd The descriptor to watch, or -1 to watch nothing.
+     *  \return void
+     */
+    void watch(Registration reg, int fd);
+
+    /**
+     *  \brief Schedules the handler to run on its I/O thread.
+     *
+     *  Notifications are coalesced: notifying a registration several times
+     *  before its handler runs results in a single call.
+     *
+     *  \param reg The registration.
+     *  \return void
+     */
+    void notify(Registration reg);
+
+    /**
+     *  \brief Runs a task once on an I/O thread.
+     *
+     *  Tasks with the same key always run on the same thread, in the order
+     *  they were handed over, between servicing sockets. Like handlers they
+     *  must not block.
+     *
+     *  \param key Picks the I/O thread.
+     *  \param task The task.
+     *  \return void
+     */
+    void execute(uint64_t key, Handler task);
+
+    /**
+     *  \brief Removes a registration.
+     *
+     *  When called from another thread this waits for a running handler to
+     *  return, so the handler's captures may be destroyed afterwards. It may
+     *  also be called from inside the handler itself.
+     *
+     *  \param reg The registration.
+     *  \return void
+     */
+    void detach(Registration reg);
+};
+
+#endif
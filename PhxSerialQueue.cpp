@@ -0,0 +1,314 @@
+#include "PhxSerialQueue.h"
+#include "PhxReactor.h"
+#include <cstdint>
+
+// Empty polls the consumer makes before it parks. Each is a pause, so this
+// is some tens of microseconds.
+#define SPIN_LIMIT 4096
+
+// Tasks a reactor drain runs before it yields the I/O thread to sockets.
+#define DRAIN_BATCH 64
+
+namespace {
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+} // namespace
+
+PhxSerialQueue::PhxSerialQueue(size_t capacity, bool timed)
+    : tail(0)
+    , head(0)
+    , overflowing(false)
+    , overflowed(0)
+    , timed(timed)
+    , started(0)
+    , totalWait(0)
+    , maxWait(0)
+    , sleeping(false)
+    , stop(false)
+    , scheduled(false) {
+    this->capacity = 2;
+    while (this->capacity < capacity) {
+        this->capacity <<= 1;
+    }
+    this->mask = this->capacity - 1;
+    this->spinLimit = std::thread::hardware_concurrency() > 1 ? SPIN_LIMIT : 0;
+
+    this->slots.reset(new Slot[this->capacity]);
+    for (size_t i = 0; i < this->capacity; i++) {
+        this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    this->worker = std::thread([this]() { this->consume(); });
+}
+
+PhxSerialQueue::PhxSerialQueue(
+    std::shared_ptr<PhxReactor> reactor, size_t capacity, bool timed)
+    : tail(0)
+    , head(0)
+    , overflowing(false)
+    , overflowed(0)
+    , timed(timed)
+    , started(0)
+    , totalWait(0)
+    , maxWait(0)
+    , sleeping(false)
+    , stop(false)
+    , reactor(std::move(reactor))
+    , scheduled(false) {
+    this->capacity = 2;
+    while (this->capacity < capacity) {
+        this->capacity <<= 1;
+    }
+    this->mask = this->capacity - 1;
+    this->spinLimit = 0;
+
+    this->slots.reset(new Slot[this->capacity]);
+    for (size_t i = 0; i < this->capacity; i++) {
+        this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+PhxSerialQueue::~PhxSerialQueue() {
+    if (this->reactor) {
+        // Wait for a drain in progress to give up the consumer role, then
+        // take it over for good and run whatever is left.
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->stop = true;
+            this->wakeup.wait(lock, [this]() { return !this->scheduled; });
+            this->scheduled = true;
+        }
+        while (this->runNext()) {
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->stop = true;
+    }
+    this->wakeup.notify_one();
+    this->worker.join();
+}
+
+void PhxSerialQueue::push(Task task) {
+    Item item;
+    item.task = std::move(task);
+    if (this->timed) {
+        item.posted = Clock::now();
+    }
+
+    if (!this->overflowing.load(std::memory_order_acquire)
+        && this->tryPush(item)) {
+        this->signal();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->overflowing = true;
+        this->overflow.push_back(std::move(item));
+        this->overflowed.store(
+            this->overflowed.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+    this->signal();
+}
+
+bool PhxSerialQueue::tryPush(Item& item) {
+    size_t pos = this->tail.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot& slot = this->slots[pos & this->mask];
+        size_t seq = slot.sequence.load(std::memory_order_acquire);
+        if (seq == pos) {
+            // seq_cst so signal() cannot miss a consumer that checked tail
+            // before parking.
+            if (this->tail.compare_exchange_weak(pos, pos + 1)) {
+                slot.item.task = std::move(item.task);
+                slot.item.posted = item.posted;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (static_cast<std::ptrdiff_t>(seq - pos) < 0) {
+            // The slot still holds the task from the previous lap.
+            return false;
+        } else {
+            pos = this->tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool PhxSerialQueue::tryPop(Item& item) {
+    Slot& slot = this->slots[this->head & this->mask];
+    size_t seq = slot.sequence.load(std::memory_order_acquire);
+    while (seq != this->head + 1) {
+        if (this->tail.load(std::memory_order_acquire) == this->head) {
+            return false;
+        }
+        // Claimed, but its producer has not finished writing the task. It
+        // may have been preempted, so give it the CPU.
+        std::this_thread::yield();
+        seq = slot.sequence.load(std::memory_order_acquire);
+    }
+
+    item.task = std::move(slot.item.task);
+    item.posted = slot.item.posted;
+    slot.sequence.store(
+        this->head + this->capacity, std::memory_order_release);
+    this->head++;
+    return true;
+}
+
+void PhxSerialQueue::signal() {
+    if (this->reactor) {
+        this->schedule();
+        return;
+    }
+
+    if (this->sleeping.load()) {
+        // Taking the mutex orders this after the consumer's last check.
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->wakeup.notify_one();
+    }
+}
+
+void PhxSerialQueue::run(Item& item) {
+    // Only this thread writes the statistics, so plain stores will do.
+    if (this->timed) {
+        int64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - item.posted).count();
+        this->totalWait.store(
+            this->totalWait.load(std::memory_order_relaxed) + wait,
+            std::memory_order_relaxed);
+        if (wait > this->maxWait.load(std::memory_order_relaxed)) {
+            this->maxWait.store(wait, std::memory_order_relaxed);
+        }
+    }
+    this->started.store(this->started.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+
+    // ThreadPool kept exceptions in futures nobody read; post() drops them
+    // too rather than lose the thread.
+    try {
+        item.task();
+    } catch (...) {
+    }
+    item.task = nullptr;
+}
+
+bool PhxSerialQueue::runNext() {
+    Item item;
+    if (this->tryPop(item)) {
+        this->run(item);
+        return true;
+    }
+
+    if (!this->overflowing.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    std::vector<Item> batch;
+    size_t claimed;
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        batch.swap(this->overflow);
+        claimed = this->tail.load();
+        if (batch.empty()) {
+            this->overflowing = false;
+        }
+    }
+
+    // Tasks claimed in the ring before the overflow was taken may have come
+    // earlier from the same producer, so they run first.
+    while (this->head != claimed && this->tryPop(item)) {
+        this->run(item);
+    }
+    for (Item& overflowed : batch) {
+        this->run(overflowed);
+    }
+    return true;
+}
+
+void PhxSerialQueue::consume() {
+    int idle = 0;
+    for (;;) {
+        if (this->runNext()) {
+            idle = 0;
+            continue;
+        }
+
+        if (this->stop) {
+            return;
+        }
+
+        if (++idle < this->spinLimit) {
+            cpuRelax();
+            continue;
+        }
+
+        idle = 0;
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->sleeping = true;
+        this->wakeup.wait(lock, [this]() {
+            return this->stop || this->tail.load() != this->head
+                || this->overflowing;
+        });
+        this->sleeping = false;
+    }
+}
+
+void PhxSerialQueue::schedule() {
+    if (!this->scheduled.exchange(true)) {
+        // One key per queue keeps its drains on one I/O thread.
+        this->reactor->execute(reinterpret_cast<uintptr_t>(this),
+            [this]() { this->drain(); });
+    }
+}
+
+void PhxSerialQueue::drain() {
+    for (int i = 0; i < DRAIN_BATCH; i++) {
+        if (!this->runNext()) {
+            break;
+        }
+    }
+
+    // Give up the consumer role before looking for more work, so a task
+    // posted meanwhile either is seen here or schedules a drain itself.
+    // Under the mutex, so a waiting destructor cannot free the queue while
+    // this still uses it.
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->scheduled = false;
+    bool pending = this->tail.load() != this->head || this->overflowing;
+    if (pending && !this->stop && !this->scheduled.exchange(true)) {
+        lock.unlock();
+        this->reactor->execute(reinterpret_cast<uintptr_t>(this),
+            [this]() { this->drain(); });
+        return;
+    }
+
+    if (this->stop) {
+        this->wakeup.notify_all();
+    }
+}
+
+PhxSerialQueue::Stats PhxSerialQueue::getStats() const {
+    Stats stats;
+    // started first: everything it counts was already in tail or overflowed,
+    // so depth cannot come out negative.
+    stats.run = this->started.load(std::memory_order_acquire);
+    stats.posted = this->tail.load()
+        + this->overflowed.load(std::memory_order_relaxed);
+    stats.depth = static_cast<size_t>(stats.posted - stats.run);
+    stats.totalWait = std::chrono::nanoseconds(
+        this->totalWait.load(std::memory_order_relaxed));
+    stats.maxWait = std::chrono::nanoseconds(
+        this->maxWait.load(std::memory_order_relaxed));
+    return stats;
+}
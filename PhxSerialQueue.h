@@ -0,0 +1,294 @@
+/**
+ *   \file PhxSerialQueue.h
+ *   \brief A single-consumer task queue with lock-free producers.
+ *
+ *  Tasks run one at a time, in order, on a thread owned by the queue. It
+ *  replaces a one-thread ThreadPool on the paths every socket event takes,
+ *  where ThreadPool's mutex and condition variable were paid per task.
+ *
+ *  Producers claim a slot in a bounded ring with a single compare and swap,
+ *  so enqueueing never takes a lock while the ring has room. Should the
+ *  ring fill up, tasks go to a mutex-guarded overflow list instead of
+ *  blocking the producer, since the consumer itself may be the producer.
+ *  Tasks from one thread always run in the order that thread enqueued them.
+ *
+ *  Tasks are PhxTasks, so posting a lambda that fits inline allocates
+ *  nothing; the ring slots are reused lap after lap.
+ *
+ *  On multicore machines the consumer spins for a while when it runs out of
+ *  work before it parks, so a steady stream of tasks never wakes it through
+ *  a futex. Producers only signal it once it has parked.
+ *
+ *  Built on a PhxReactor instead, the queue has no thread at all: it hands
+ *  a drain to one of the reactor's I/O threads whenever it has work, and
+ *  that drain runs a batch of tasks at a time. Thousands of queues can then
+ *  share a few threads, at the price that tasks must not block.
+ *
+ *  getStats() reports how far behind the consumer is. Timing how long tasks
+ *  wait costs a clock read on each side, so it is only done when asked for
+ *  at construction.
+ */
+#ifndef PhxSerialQueue_H
+#define PhxSerialQueue_H
+
+#include "PhxTask.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class PhxReactor;
+
+class PhxSerialQueue {
+public:
+    /*!< A unit of work run on the queue's thread. */
+    using Task = PhxTask;
+
+    struct Stats {
+        /*!< Tasks queued and not yet started. */
+        size_t depth;
+
+        /*!< Tasks queued since construction. */
+        uint64_t posted;
+
+        /*!< Tasks started since construction. */
+        uint64_t run;
+
+        /*!< Time started tasks spent queued, in total. Zero if not timed. */
+        std::chrono::nanoseconds totalWait;
+
+        /*!< The longest any started task spent queued. Zero if not timed. */
+        std::chrono::nanoseconds maxWait;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Item {
+        Task task;
+
+        /*!< When the task was queued, if timed. */
+        Clock::time_point posted;
+    };
+
+    struct Slot {
+        /*!<
+         * pos + 1 once the task for ring position pos is written, and
+         * pos + capacity once the consumer has taken it, freeing the slot
+         * for the next lap.
+         */
+        std::atomic<size_t> sequence;
+
+        Item item;
+    };
+
+    /*!< The ring, capacity slots long. */
+    std::unique_ptr<Slot[]> slots;
+
+    /*!< Number of slots, a power of two. */
+    size_t capacity;
+
+    /*!< capacity - 1, to turn positions into slot indices. */
+    size_t mask;
+
+    /*!< The next position producers claim. */
+    std::atomic<size_t> tail;
+
+    /*!< The next position the consumer takes. Only the consumer uses it. */
+    size_t head;
+
+    /*!<
+     * Set while overflow may hold tasks. Producers that see it queue onto
+     * overflow as well, so nothing they enqueue overtakes their earlier
+     * tasks.
+     */
+    std::atomic<bool> overflowing;
+
+    /*!< Tasks that did not fit in the ring, guarded by mutex. */
+    std::vector<Item> overflow;
+
+    /*!< Tasks ever queued onto overflow, written under mutex. */
+    std::atomic<uint64_t> overflowed;
+
+    /*!< Whether tasks are timestamped for the wait statistics. */
+    bool timed;
+
+    /*!< Tasks started. Only the consumer writes the statistics. */
+    std::atomic<uint64_t> started;
+
+    /*!< Summed wait of started tasks, in nanoseconds. */
+    std::atomic<int64_t> totalWait;
+
+    /*!< Longest wait of a started task, in nanoseconds. */
+    std::atomic<int64_t> maxWait;
+
+    /*!< Whether the consumer is parked, or about to, on wakeup. */
+    std::atomic<bool> sleeping;
+
+    /*!<
+     * Empty polls before parking, 0 on a single core where spinning only
+     * keeps producers off the CPU.
+     */
+    int spinLimit;
+
+    /*!< Set by the destructor to stop the consumer once it is drained. */
+    std::atomic<bool> stop;
+
+    /*!< Guards overflow and parking. */
+    std::mutex mutex;
+
+    /*!< Signalled to wake a parked consumer, or a destructor waiting on a
+     * drain. */
+    std::condition_variable wakeup;
+
+    /*!< The consumer thread, unless the queue runs on reactor. */
+    std::thread worker;
+
+    /*!< The reactor whose I/O threads drain the queue, if any. */
+    std::shared_ptr<PhxReactor> reactor;
+
+    /*!<
+     * With a reactor, set while a drain is handed over or running. Whoever
+     * sets it is the consumer until it is cleared.
+     */
+    std::atomic<bool> scheduled;
+
+    /**
+     *  \brief Queues a task, into the ring if it has room.
+     *
+     *  \param task The task to run.
+     *  \return void
+     */
+    void push(Task task);
+
+    /**
+     *  \brief Claims a slot and stores item in it.
+     *
+     *  \param item The task, only moved from on success.
+     *  \return bool false if the ring is full.
+     */
+    bool tryPush(Item& item);
+
+    /**
+     *  \brief Takes the task at head, waiting if its producer has claimed
+     *  the slot but not yet filled it.
+     *
+     *  \param item Receives the task.
+     *  \return bool false if the ring is empty.
+     */
+    bool tryPop(Item& item);
+
+    /**
+     *  \brief Wakes the consumer if it is parked.
+     *
+     *  \return void
+     */
+    void signal();
+
+    /**
+     *  \brief Runs a task, keeping its exceptions from ending the thread,
+     *  and counts it in the statistics.
+     *
+     *  \param item The task to run.
+     *  \return void
+     */
+    void run(Item& item);
+
+    /**
+     *  \brief Runs the next task, or the overflowed tasks, if any.
+     *
+     *  Only the consumer calls this.
+     *
+     *  \return bool false if there was nothing to run.
+     */
+    bool runNext();
+
+    /**
+     *  \brief The consumer loop.
+     *
+     *  \return void
+     */
+    void consume();
+
+    /**
+     *  \brief Hands a drain to the reactor unless one is already pending.
+     *
+     *  \return void
+     */
+    void schedule();
+
+    /**
+     *  \brief Runs a batch of tasks on a reactor thread, then hands over
+     *  another drain or gives up the consumer role.
+     *
+     *  \return void
+     */
+    void drain();
+
+public:
+    /**
+     *  \brief Constructor
+     *
+     *  Starts the consumer thread.
+     *
+     *  \param capacity Slots in the ring, rounded up to a power of two.
+     *  \param timed Whether to time how long tasks wait, for getStats().
+     *  \return PhxSerialQueue
+     */
+    explicit PhxSerialQueue(size_t capacity = 1024, bool timed = false);
+
+    /**
+     *  \brief Constructor for a queue drained by a reactor.
+     *
+     *  No thread is started; tasks run on reactor's I/O threads, in order
+     *  and one at a time as ever, and must not block.
+     *
+     *  \param reactor The reactor to run tasks on.
+     *  \param capacity Slots in the ring, rounded up to a power of two.
+     *  \param timed Whether to time how long tasks wait, for getStats().
+     *  \return PhxSerialQueue
+     */
+    explicit PhxSerialQueue(std::shared_ptr<PhxReactor> reactor,
+        size_t capacity = 1024,
+        bool timed = false);
+
+    /**
+     *  \brief Destructor
+     *
+     *  Runs the tasks already enqueued, then joins the consumer thread. A
+     *  queue on a reactor waits for a drain in progress and runs the rest
+     *  itself, so it must not be destroyed on one of reactor's threads.
+     */
+    ~PhxSerialQueue();
+
+    /**
+     *  \brief Queues a callable to run after those already queued.
+     *
+     *  Safe to call from any thread, including from a task. Nothing is
+     *  returned to wait on; the callable's result and any exception it
+     *  throws are dropped. Callables may be move-only.
+     *
+     *  \param f The callable, taking no arguments.
+     *  \return void
+     */
+    template <class F> void post(F&& f) {
+        this->push(Task(std::forward<F>(f)));
+    }
+
+    /**
+     *  \brief A snapshot of the queue's statistics.
+     *
+     *  Safe to call from any thread. The counters are read one at a time
+     *  while tasks come and go, so they need not agree exactly.
+     *
+     *  \return Stats
+     */
+    Stats getStats() const;
+};
+
+#endif
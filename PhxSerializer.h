@@ -0,0 +1,187 @@
+/**
+ *   \file PhxSerializer.h
+ *   \brief Encodes and decodes Phoenix messages on the wire.
+ *
+ *  Phoenix has two JSON formats, chosen by the vsn param of the socket URL:
+ *
+ *  - 1.0.0 sends each message as an object,
+ *    {"topic": ..., "event": ..., "payload": ..., "ref": ...}.
+ *  - 2.0.0 sends it as an array, [join_ref, ref, topic, event, payload],
+ *    so no frame repeats the key names.
+ *
+ *  PhxBinarySerializer sends the same array as MessagePack or CBOR in binary
+ *  frames. Phoenix has no vsn for that, so the server has to map one to a
+ *  matching serializer of its own.
+ *
+ *  PhxSocket picks the serializer matching the vsn it connects with, or
+ *  uses one set with PhxSocket::setSerializer.
+ */
+#ifndef PhxSerializer_H
+#define PhxSerializer_H
+
+#include "json.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class PhxEnvelope;
+
+class PhxSerializer {
+public:
+    virtual ~PhxSerializer() {
+    }
+
+    /**
+     *  \brief The vsn param that tells the server to use this format.
+     *
+     *  \return const char*
+     */
+    virtual const char* getVsn() const = 0;
+
+    /**
+     *  \brief Encodes a message.
+     *
+     *  \param topic The topic of the message.
+     *  \param event The event of the message.
+     *  \param payload The payload of the message.
+     *  \param ref The ref of the message, -1 for none.
+     *  \param joinRef The ref of the join the message belongs to, -1 for none.
+     *  \return std::string The frame to send.
+     */
+    virtual std::string encode(const std::string& topic,
+        const std::string& event,
+        const nlohmann::json& payload,
+        int64_t ref,
+        int64_t joinRef) const = 0;
+
+    /**
+     *  \brief Decodes a frame.
+     *
+     *  \param frame The frame, which the envelope takes ownership of.
+     *  \param envelope Receives the message.
+     *  \return bool false if the frame is not a Phoenix message.
+     */
+    virtual bool decode(std::string frame, PhxEnvelope& envelope) const = 0;
+
+    /**
+     *  \brief Whether messages are sent in binary frames.
+     *
+     *  \return bool
+     */
+    virtual bool isBinary() const;
+
+    /**
+     *  \brief Encodes a message for a binary frame.
+     *
+     *  Called instead of encode() when isBinary() is true.
+     *
+     *  \param topic The topic of the message.
+     *  \param event The event of the message.
+     *  \param payload The payload of the message.
+     *  \param ref The ref of the message, -1 for none.
+     *  \param joinRef The ref of the join the message belongs to, -1 for none.
+     *  \return std::vector<uint8_t> The frame to send.
+     */
+    virtual std::vector<uint8_t> encodeBinary(const std::string& topic,
+        const std::string& event,
+        const nlohmann::json& payload,
+        int64_t ref,
+        int64_t joinRef) const;
+
+    /**
+     *  \brief Decodes a binary frame.
+     *
+     *  \param frame The frame.
+     *  \param envelope Receives the message.
+     *  \return bool false if the frame is not a Phoenix message, which is
+     *  always the case for text serializers.
+     */
+    virtual bool decodeBinary(
+        const std::vector<uint8_t>& frame, PhxEnvelope& envelope) const;
+
+    /**
+     *  \brief The serializer for a vsn param.
+     *
+     *  \param vsn "2.0.0" for the array format; anything else, including
+     *  an empty string, gets the object format.
+     *  \return std::shared_ptr<PhxSerializer>
+     */
+    static std::shared_ptr<PhxSerializer> forVsn(const std::string& vsn);
+};
+
+/**
+ *  \brief The 1.0.0 object format.
+ */
+class PhxSerializerV1 : public PhxSerializer {
+public:
+    const char* getVsn() const;
+    std::string encode(const std::string& topic,
+        const std::string& event,
+        const nlohmann::json& payload,
+        int64_t ref,
+        int64_t joinRef) const;
+    bool decode(std::string frame, PhxEnvelope& envelope) const;
+};
+
+/**
+ *  \brief The 2.0.0 array format.
+ */
+class PhxSerializerV2 : public PhxSerializer {
+public:
+    const char* getVsn() const;
+    std::string encode(const std::string& topic,
+        const std::string& event,
+        const nlohmann::json& payload,
+        int64_t ref,
+        int64_t joinRef) const;
+    bool decode(std::string frame, PhxEnvelope& envelope) const;
+};
+
+/**
+ *  \brief The 2.0.0 array encoded as MessagePack or CBOR.
+ *
+ *  Messages are sent in binary frames. Text frames from the server are
+ *  still read as 2.0.0 arrays.
+ */
+class PhxBinarySerializer : public PhxSerializerV2 {
+public:
+    enum class Format { MSGPACK, CBOR };
+
+    /**
+     *  \brief Constructor
+     *
+     *  \param format The binary encoding.
+     *  \param vsn The vsn the server maps to its matching serializer.
+     *  \return PhxBinarySerializer
+     */
+    PhxBinarySerializer(Format format, const std::string& vsn);
+
+    const char* getVsn() const;
+    bool isBinary() const;
+    std::vector<uint8_t> encodeBinary(const std::string& topic,
+        const std::string& event,
+        const nlohmann::json& payload,
+        int64_t ref,
+        int64_t joinRef) const;
+    bool decodeBinary(
+        const std::vector<uint8_t>& frame, PhxEnvelope& envelope) const;
+
+private:
+    /*!< The binary encoding. */
+    Format format;
+
+    /*!< The vsn sent when connecting. */
+    std::string vsn;
+
+    /**
+     *  \brief Appends the encoding of value to out.
+     *
+     *  \param out The frame being built.
+     *  \param value The value to encode.
+     *  \return void
+     */
+    void append(std::vector<uint8_t>& out, const nlohmann::json& value) const;
+};
+
+#endif
@@ -1,21 +1,77 @@
 #include "PhxSocket.h"
 #include "EasySocket.h"
 #include "PhxChannel.h"
-#include "ThreadPool.h"
+#include "PhxDispatcher.h"
+#include "PhxEnvelope.h"
+#include "PhxSerialQueue.h"
+#include "PhxSerializer.h"
 #include <algorithm>
+#include <cctype>
 #include <chrono>
-#include <future>
+#include <cstdlib>
+#include <functional>
 #include <map>
 #include <string>
-#include <thread>
 
-#define POOL_SIZE 1
 
-PhxSocket::PhxSocket(const std::string& url, int interval)
-    : pool(POOL_SIZE) {
+namespace {
+
+std::string urlEncode(const std::string& s) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    for (char c : s) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (isalnum(u) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[u >> 4];
+            out += hex[u & 15];
+        }
+    }
+    return out;
+}
+
+// The value of key in the query of url, or an empty string.
+std::string queryValue(const std::string& url, const std::string& key) {
+    size_t pos = url.find('?');
+    while (pos != std::string::npos) {
+        size_t begin = pos + 1;
+        size_t end = url.find_first_of("&#", begin);
+        if (url.compare(begin, key.size() + 1, key + "=") == 0) {
+            begin += key.size() + 1;
+            return url.substr(
+                begin, end == std::string::npos ? end : end - begin);
+        }
+        pos = end != std::string::npos && url[end] == '&' ? end
+                                                          : std::string::npos;
+    }
+    return std::string();
+}
+
+int64_t refFromJson(const nlohmann::json& ref) {
+    if (ref.is_number()) {
+        return ref.get<int64_t>();
+    }
+    if (ref.is_string()) {
+        return std::strtoll(ref.get<std::string>().c_str(), nullptr, 10);
+    }
+    return -1;
+}
+
+// The dispatcher key for a topic's messages.
+size_t topicKey(const std::string& topic) {
+    return std::hash<std::string>()(topic);
+}
+
+} // namespace
+
+PhxSocket::PhxSocket(const std::string& url, int interval) {
     this->url = url;
     this->heartBeatInterval = interval;
     this->reconnectOnError = true;
+    this->serializer = PhxSerializer::forVsn(queryValue(url, "vsn"));
+    this->serializerSet = false;
 }
 
 PhxSocket::PhxSocket(const std::string& url)
@@ -23,35 +79,78 @@ PhxSocket::PhxSocket(const std::string& url)
 }
 
 PhxSocket::PhxSocket(
-    const std::string& url, int interval, std::shared_ptr<WebSocket> socket)
-    : pool(POOL_SIZE) {
+    const std::string& url, int interval, std::shared_ptr<WebSocket> socket) {
     this->url = url;
     this->heartBeatInterval = interval;
     this->reconnectOnError = true;
+    this->serializer = PhxSerializer::forVsn(queryValue(url, "vsn"));
+    this->serializerSet = false;
     this->socket = std::move(socket);
 }
 
+// Reactor users run many sockets, so pool's ring is kept small; bursts
+// beyond it go to the overflow list.
+PhxSocket::PhxSocket(
+    const std::string& url, int interval, std::shared_ptr<PhxReactor> reactor)
+    : pool(reactor, 64)
+    , reactor(reactor) {
+    this->url = url;
+    this->heartBeatInterval = interval;
+    this->reconnectOnError = true;
+    this->serializer = PhxSerializer::forVsn(queryValue(url, "vsn"));
+    this->serializerSet = false;
+}
+
+PhxSocket::PhxSocket(const std::string& url,
+    int interval,
+    std::shared_ptr<PhxDispatcher> dispatcher)
+    : PhxSocket(url, interval) {
+    this->dispatcher = std::move(dispatcher);
+}
+
+PhxSocket::~PhxSocket() {
+    this->discardHeartBeatTimer();
+    this->discardReconnectTimer();
+}
+
 void PhxSocket::connect() {
     this->connect(std::map<std::string, std::string>());
 }
 
 void PhxSocket::connect(std::map<std::string, std::string> params) {
-    std::string url;
     this->params = params;
 
-    // FIXME: Add the parameters to the url.
-    if (this->params.size() > 0) {
-        url = this->url;
-    } else {
-        url = this->url;
+    if (this->serializerSet) {
+        params["vsn"] = std::atomic_load(&this->serializer)->getVsn();
+    }
+
+    std::string url = this->url;
+    for (const auto& param : params) {
+        url += url.find('?') == std::string::npos ? '?' : '&';
+        url += urlEncode(param.first);
+        url += '=';
+        url += urlEncode(param.second);
+    }
+
+    if (!this->serializerSet) {
+        // A vsn in params comes after any in this->url, and the server
+        // takes the last.
+        auto vsn = params.find("vsn");
+        std::atomic_store(&this->serializer,
+            PhxSerializer::forVsn(
+                vsn != params.end() ? vsn->second : queryValue(url, "vsn")));
     }
 
-    this->setCanReconnect(false);
+    this->discardReconnectTimer();
 
     // The socket hasn't been instantiated with a custom WebSocket.
     if (!this->socket) {
-        std::shared_ptr<EasySocket> socket
-            = std::make_shared<EasySocket>(url, this);
+        std::shared_ptr<EasySocket> socket = this->reactor
+            ? std::make_shared<EasySocket>(url, this, this->reactor)
+            : std::make_shared<EasySocket>(url, this);
+        // Our callbacks only queue onto pool, so the receive thread would
+        // be a second hop for every message.
+        socket->setDirectDelivery(true);
         this->socket = std::dynamic_pointer_cast<WebSocket, EasySocket>(socket);
     }
 
@@ -91,14 +190,8 @@ bool PhxSocket::isConnected() {
 }
 
 void PhxSocket::sendHeartbeat() {
-    // clang-format off
-    this->push({
-            { "topic", "phoenix" },
-            { "event", "heartbeat" },
-            { "payload", {} },
-            { "ref", this->makeRef() }
-        });
-    // clang-format on
+    this->push("phoenix", "heartbeat", nlohmann::json::object(),
+        this->makeRef(), -1);
 }
 
 int64_t PhxSocket::makeRef() {
@@ -115,17 +208,70 @@ SocketState PhxSocket::socketState() {
 }
 
 void PhxSocket::push(nlohmann::json data) {
-    this->socket->send(data.dump());
+    if (!data.is_object()) {
+        this->socket->send(data.dump());
+        return;
+    }
+
+    auto topic = data.find("topic");
+    auto event = data.find("event");
+    auto payload = data.find("payload");
+    auto ref = data.find("ref");
+    auto joinRef = data.find("join_ref");
+    if (topic == data.end() || !topic->is_string() || event == data.end()
+        || !event->is_string()) {
+        this->socket->send(data.dump());
+        return;
+    }
+
+    this->push(topic->get<std::string>(), event->get<std::string>(),
+        payload != data.end() ? *payload : nlohmann::json::object(),
+        ref != data.end() ? refFromJson(*ref) : -1,
+        joinRef != data.end() ? refFromJson(*joinRef) : -1);
+}
+
+void PhxSocket::push(const std::string& topic,
+    const std::string& event,
+    const nlohmann::json& payload,
+    int64_t ref,
+    int64_t joinRef) {
+    std::shared_ptr<PhxSerializer> serializer
+        = std::atomic_load(&this->serializer);
+    if (serializer->isBinary()) {
+        this->socket->sendBinary(
+            serializer->encodeBinary(topic, event, payload, ref, joinRef));
+    } else {
+        this->socket->send(
+            serializer->encode(topic, event, payload, ref, joinRef));
+    }
+}
+
+void PhxSocket::setSerializer(std::shared_ptr<PhxSerializer> serializer) {
+    this->serializerSet = true;
+    std::atomic_store(&this->serializer, std::move(serializer));
+}
+
+void PhxSocket::setDispatcher(std::shared_ptr<PhxDispatcher> dispatcher) {
+    std::atomic_store(&this->dispatcher, std::move(dispatcher));
 }
 
 // Private
 
 void PhxSocket::discardHeartBeatTimer() {
-    this->setCanSendHeartBeat(false);
+    PhxTimerWheel::TimerId timer = this->heartBeatTimer.exchange(0);
+    if (timer) {
+        PhxTimerWheel::shared().cancel(timer);
+    }
 }
 
 void PhxSocket::discardReconnectTimer() {
-    this->setCanReconnect(false);
+    PhxTimerWheel::TimerId timer = this->reconnectTimer.exchange(0);
+    if (timer) {
+        // Whether or not the timer already fired, its callback will now
+        // find no timer and skip the reconnect, so clear the flag here.
+        PhxTimerWheel::shared().cancel(timer);
+        this->reconnecting = false;
+    }
 }
 
 void PhxSocket::disconnectSocket() {
@@ -142,21 +288,16 @@ void PhxSocket::onConnOpen() {
     // After the socket connection is opened, continue to send heartbeats
     // to keep the connection alive.
     if (this->heartBeatInterval > 0) {
-        std::thread thread([this]() {
-            this->setCanSendHeartBeat(true);
-            while (true) {
-                std::this_thread::sleep_for(
-                    std::chrono::seconds{ this->heartBeatInterval });
-
-                if (this->canSendHeartbeat) {
-                    this->pool.enqueue([this]() { this->sendHeartbeat(); });
-                } else {
-                    break;
-                }
-            }
-        });
-
-        thread.detach();
+        this->discardHeartBeatTimer();
+        this->heartBeatTimer = PhxTimerWheel::shared().scheduleRepeating(
+            std::chrono::seconds{ this->heartBeatInterval }, [this]() {
+                this->pool.post([this]() {
+                    // The timer may have been discarded while this was queued.
+                    if (this->heartBeatTimer) {
+                        this->sendHeartbeat();
+                    }
+                });
+            });
     }
 
     for (int i = 0; i < this->openCallbacks.size(); i++) {
@@ -176,23 +317,17 @@ void PhxSocket::onConnClose(const std::string& event) {
     if (this->reconnectOnError) {
         if (!this->reconnecting) {
             this->reconnecting = true;
-            this->canReconnect = true;
-
-            std::thread thread([this]() {
-                std::this_thread::sleep_for(
-                    std::chrono::seconds{ RECONNECT_INTERVAL });
-
-                this->pool.enqueue([this]() {
-                    if (this->canReconnect) {
-                        this->canReconnect = false;
-                        this->reconnect();
-                    }
 
-                    this->reconnecting = false;
+            this->reconnectTimer = PhxTimerWheel::shared().schedule(
+                std::chrono::seconds{ RECONNECT_INTERVAL }, [this]() {
+                    this->pool.post([this]() {
+                        // Zero means the reconnect was discarded meanwhile.
+                        if (this->reconnectTimer.exchange(0)) {
+                            this->reconnecting = false;
+                            this->reconnect();
+                        }
+                    });
                 });
-            });
-
-            thread.detach();
         }
     }
 
@@ -223,85 +358,209 @@ void PhxSocket::onConnError(const std::string& error) {
     this->onConnClose(error);
 }
 
-void PhxSocket::onConnMessage(const std::string& rawMessage) {
-    nlohmann::json json = nlohmann::json::parse(rawMessage);
-    const std::string json_topic = json["topic"];
-    const std::string json_event = json["event"];
-    nlohmann::json json_ref = json["ref"];
-    nlohmann::json json_payload = json["payload"];
+void PhxSocket::onConnMessage(std::string rawMessage) {
+    PhxEnvelope envelope;
+    if (std::atomic_load(&this->serializer)
+            ->decode(std::move(rawMessage), envelope)) {
+        this->onConnEnvelope(std::move(envelope));
+    }
+}
+
+void PhxSocket::onConnBinaryMessage(const std::vector<uint8_t>& rawMessage) {
+    PhxEnvelope envelope;
+    if (std::atomic_load(&this->serializer)
+            ->decodeBinary(rawMessage, envelope)) {
+        this->onConnEnvelope(std::move(envelope));
+    }
+}
+
+void PhxSocket::onConnEnvelope(PhxEnvelope envelope) {
+    // Copy the matching channels out so handlers run unlocked and may
+    // add or remove channels themselves. The common single channel case
+    // copies just one pointer.
+    std::shared_ptr<PhxChannel> channel;
+    std::vector<std::shared_ptr<PhxChannel>> shared;
+    {
+        std::lock_guard<std::mutex> guard(this->channelsMutex);
+        auto found = this->channels.find(envelope.getTopic());
+        if (found != this->channels.end()) {
+            if (found->second.size() == 1) {
+                channel = found->second.front();
+            } else {
+                shared = found->second;
+            }
+        }
+    }
+
+    bool notify = !this->messageCallbacks.empty();
+    std::shared_ptr<PhxDispatcher> dispatcher
+        = std::atomic_load(&this->dispatcher);
+    if (dispatcher) {
+        // The envelope moves to the dispatcher, where its payload may be
+        // parsed at any time, so socket callbacks get a copy of their own.
+        // It is turned into json on pool, as we may be on the receiving
+        // thread and a malformed payload throws.
+        if (notify) {
+            this->pool.post(std::bind(
+                [this](const PhxEnvelope& envelope) {
+                    this->triggerMessageCallbacks(envelope.toJson());
+                },
+                envelope));
+        }
+        if (channel) {
+            shared.push_back(std::move(channel));
+        }
+        if (!shared.empty()) {
+            size_t key = topicKey(envelope.getTopic());
+            dispatcher->dispatch(key,
+                std::bind(
+                    [](std::vector<std::shared_ptr<PhxChannel>>& channels,
+                        const PhxEnvelope& envelope) {
+                        for (const std::shared_ptr<PhxChannel>& c : channels) {
+                            if (c->isMember(envelope)) {
+                                c->dispatch(envelope);
+                            }
+                        }
+                    },
+                    std::move(shared), std::move(envelope)));
+        }
+        return;
+    }
 
-    // Ref can be null, so check for it first.
-    int64_t ref = -1;
-    if (!json_ref.is_null()) {
-        ref = json_ref;
+    if (channel && channel->isMember(envelope)) {
+        channel->dispatch(envelope);
     }
 
-    for (int i = 0; i < this->channels.size(); i++) {
-        std::shared_ptr<PhxChannel> channel = this->channels.at(i);
-        if (channel->getTopic() == json_topic) {
-            channel->triggerEvent(json_event, json_payload, ref);
+    for (const std::shared_ptr<PhxChannel>& c : shared) {
+        if (c->isMember(envelope)) {
+            c->dispatch(envelope);
         }
     }
 
+    if (notify) {
+        this->triggerMessageCallbacks(envelope.toJson());
+    }
+}
+
+void PhxSocket::triggerMessageCallbacks(const nlohmann::json& message) {
     for (int i = 0; i < this->messageCallbacks.size(); i++) {
         OnMessage callback = this->messageCallbacks.at(i);
-        callback(json);
+        callback(message);
     }
 }
 
 void PhxSocket::triggerChanError(const std::string& error) {
-    for (int i = 0; i < this->channels.size(); i++) {
-        std::shared_ptr<PhxChannel> channel = this->channels.at(i);
-        channel->triggerEvent("phx_error", error, 0);
+    std::vector<std::shared_ptr<PhxChannel>> all;
+    {
+        std::lock_guard<std::mutex> guard(this->channelsMutex);
+        for (const auto& topic : this->channels) {
+            all.insert(all.end(), topic.second.begin(), topic.second.end());
+        }
+    }
+
+    std::shared_ptr<PhxDispatcher> dispatcher
+        = std::atomic_load(&this->dispatcher);
+    for (const std::shared_ptr<PhxChannel>& channel : all) {
+        if (dispatcher) {
+            // Through the topic's strand, so it follows the messages
+            // already handed over.
+            dispatcher->dispatch(topicKey(channel->getTopic()),
+                [channel, error]() {
+                    channel->triggerEvent("phx_error", error, 0);
+                });
+        } else {
+            channel->triggerEvent("phx_error", error, 0);
+        }
     }
 }
 
 void PhxSocket::addChannel(std::shared_ptr<PhxChannel> channel) {
-    this->channels.emplace_back(channel);
+    std::lock_guard<std::mutex> guard(this->channelsMutex);
+    std::vector<std::shared_ptr<PhxChannel>>& chans
+        = this->channels[channel->getTopic()];
+    if (std::find(chans.begin(), chans.end(), channel) == chans.end()) {
+        chans.emplace_back(std::move(channel));
+    }
 }
 
 void PhxSocket::removeChannel(std::shared_ptr<PhxChannel> channel) {
-    std::vector<std::shared_ptr<PhxChannel>> chans = this->channels;
+    std::lock_guard<std::mutex> guard(this->channelsMutex);
+    auto found = this->channels.find(channel->getTopic());
+    if (found == this->channels.end()) {
+        return;
+    }
+
+    std::vector<std::shared_ptr<PhxChannel>>& chans = found->second;
     std::vector<std::shared_ptr<PhxChannel>>::iterator position
         = std::find(chans.begin(), chans.end(), channel);
     if (position != chans.end()) {
         chans.erase(position);
     }
+
+    if (chans.empty()) {
+        this->channels.erase(found);
+    }
 }
 
 void PhxSocket::setDelegate(std::shared_ptr<PhxSocketDelegate> delegate) {
     this->delegate = delegate;
 }
 
-void PhxSocket::setCanReconnect(bool canReconnect) {
-    this->pool.enqueue(
-        [this, canReconnect]() { this->canReconnect = canReconnect; });
-}
-
-void PhxSocket::setCanSendHeartBeat(bool canSendHeartbeat) {
-    this->pool.enqueue([this, canSendHeartbeat]() {
-        this->canSendHeartbeat = canSendHeartbeat;
-    });
-}
-
 // SocketDelegate
 
 void PhxSocket::webSocketDidOpen(WebSocket* socket) {
-    this->pool.enqueue([this]() { this->onConnOpen(); });
+    this->pool.post([this]() { this->onConnOpen(); });
 }
 
 void PhxSocket::webSocketDidReceive(
     WebSocket* socket, const std::string& message) {
-    this->pool.enqueue([this, message]() { this->onConnMessage(message); });
+    this->webSocketDidReceive(socket, std::string(message));
+}
+
+void PhxSocket::webSocketDidReceive(WebSocket* socket, std::string&& message) {
+    if (std::atomic_load(&this->dispatcher)) {
+        // Routing only scans the envelope, so it is done here and the
+        // message reaches the dispatcher in one hop, without queueing
+        // behind socket events on pool.
+        this->onConnMessage(std::move(message));
+        return;
+    }
+
+    // C++11 lambdas cannot capture by move, so the message is bound
+    // instead. The bound task is small enough for pool to store inline.
+    this->pool.post(std::bind(
+        [this](std::string& message) {
+            this->onConnMessage(std::move(message));
+        },
+        std::move(message)));
+}
+
+void PhxSocket::webSocketDidReceiveBinary(
+    WebSocket* socket, const std::vector<uint8_t>& message) {
+    this->webSocketDidReceiveBinary(socket, std::vector<uint8_t>(message));
+}
+
+void PhxSocket::webSocketDidReceiveBinary(
+    WebSocket* socket, std::vector<uint8_t>&& message) {
+    if (std::atomic_load(&this->dispatcher)) {
+        this->onConnBinaryMessage(message);
+        return;
+    }
+
+    this->pool.post(std::bind(
+        [this](const std::vector<uint8_t>& message) {
+            this->onConnBinaryMessage(message);
+        },
+        std::move(message)));
 }
 
 void PhxSocket::webSocketDidError(WebSocket* socket, const std::string& error) {
-    this->pool.enqueue([this, error]() { this->onConnError(error); });
+    this->pool.post([this, error]() { this->onConnError(error); });
 }
 
 void PhxSocket::webSocketDidClose(
     WebSocket* socket, int code, const std::string& reason, bool wasClean) {
-    this->pool.enqueue([this, reason]() { this->onConnClose(reason); });
+    this->pool.post([this, reason]() { this->onConnClose(reason); });
 }
 
 // SocketDelegate
@@ -8,13 +8,17 @@
 #ifndef PhxSocketDelegate_H
 #define PhxSocketDelegate_H
 
+#include "PhxSerialQueue.h"
+#include "PhxTimerWheel.h"
 #include "PhxTypes.h"
 #include "SocketDelegate.h"
-#include "ThreadPool.h"
 #include "WebSocket.h"
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class PhxSocketDelegate {
@@ -28,6 +32,10 @@ public:
 
 // Forward Declares
 class PhxChannel;
+class PhxDispatcher;
+class PhxEnvelope;
+class PhxReactor;
+class PhxSerializer;
 class WebSocket;
 
 #ifndef PhxSocket_H
@@ -37,8 +45,11 @@ class WebSocket;
 
 class PhxSocket : public SocketDelegate {
 private:
-    /*!< Single Thread Thread Pool used for synchronization. */
-    ThreadPool pool;
+    /*!<
+     * Runs socket events one at a time, in order, off the I/O thread. With
+     * a reactor it has no thread of its own and runs on the reactor's.
+     */
+    PhxSerialQueue pool;
 
     /*! Delegate that can listen in on Phoenix related callbacks. */
     std::weak_ptr<PhxSocketDelegate> delegate;
@@ -49,6 +60,9 @@ private:
      */
     std::shared_ptr<WebSocket> socket;
 
+    /*!< Shared reactor the default EasySocket is serviced by, if any. */
+    std::shared_ptr<PhxReactor> reactor;
+
     /*!< Flag indicating whether or not to reconnect when socket errors out. */
     bool reconnectOnError;
 
@@ -58,9 +72,16 @@ private:
     /*!< The interval at which to send heartbeats to server. */
     int heartBeatInterval;
 
-    /*!< The list of channels interested in sending messages over this socket.
+    /*!<
+     * The channels interested in sending messages over this socket, indexed
+     * by topic so routing an incoming message is a single lookup. A topic
+     * usually has one channel but may have several.
      */
-    std::vector<std::shared_ptr<PhxChannel>> channels;
+    std::unordered_map<std::string, std::vector<std::shared_ptr<PhxChannel>>>
+        channels;
+
+    /*!< Guards channels. */
+    std::mutex channelsMutex;
 
     /*!< List of callbacks when socket opens. */
     std::vector<OnOpen> openCallbacks;
@@ -77,8 +98,28 @@ private:
     /*!< These params are used to pass arguments into the Websocket URL. */
     std::map<std::string, std::string> params;
 
-    /*!< Ref to keep track of for each WebSocket message. */
-    int ref = 0;
+    /*!<
+     * Encodes outgoing and decodes incoming messages. Replaced on connect
+     * and read from other threads, so only accessed with std::atomic_load
+     * and std::atomic_store.
+     */
+    std::shared_ptr<PhxSerializer> serializer;
+
+    /*!< Whether serializer was set by setSerializer rather than by vsn. */
+    bool serializerSet;
+
+    /*!<
+     * Runs channel callbacks in parallel across topics, if set. Read from
+     * pool and the receiving thread while it may be replaced, so only
+     * accessed with std::atomic_load and std::atomic_store.
+     */
+    std::shared_ptr<PhxDispatcher> dispatcher;
+
+    /*!<
+     * Ref to keep track of for each WebSocket message. Atomic since
+     * callbacks on a dispatcher may push from several threads.
+     */
+    std::atomic<int64_t> ref{ 0 };
 
     /**
      *  \brief Stops the heartbeating.
@@ -87,8 +128,8 @@ private:
      */
     void discardHeartBeatTimer();
 
-    /*!< Flag indicating whether or not to continue sending heartbeats. */
-    bool canSendHeartbeat;
+    /*!< The repeating heartbeat timer, 0 when not heartbeating. */
+    std::atomic<PhxTimerWheel::TimerId> heartBeatTimer{ 0 };
 
     /**
      *  \brief Stops trying to reconnect the WebSocket.
@@ -97,12 +138,12 @@ private:
      */
     void discardReconnectTimer();
 
-    /*!< Flag indicating whether or not socket can reconnect to server. */
-    bool canReconnect;
+    /*!< The pending reconnect timer, 0 when none is scheduled. */
+    std::atomic<PhxTimerWheel::TimerId> reconnectTimer{ 0 };
 
     /*!< Flag indicating whether or not we are in the process of reconnecting.
      */
-    bool reconnecting;
+    std::atomic<bool> reconnecting{ false };
 
     /**
      *  \brief Disconnects the socket.
@@ -137,50 +178,65 @@ private:
     /**
      *  \brief Function called when WebSocket receives a message.
      *
+     *  Only the routing fields are scanned up front; the payload is parsed
+     *  if and when a handler needs it.
+     *
      *  \param rawMessage The message as a std::string.
      *  \return void
      */
-    void onConnMessage(const std::string& rawMessage);
+    void onConnMessage(std::string rawMessage);
 
     /**
-     *  \brief Triggers a "phx_error" event to all channels.
+     *  \brief Function called when WebSocket receives a binary message.
      *
-     *  \param error The error message.
+     *  \param rawMessage The bytes of the message.
      *  \return void
      */
-    void triggerChanError(const std::string& error);
+    void onConnBinaryMessage(const std::vector<uint8_t>& rawMessage);
 
     /**
-     *  \brief Sends a heartbeat to keep Websocket connection alive.
+     *  \brief Routes a decoded message to its channels and callbacks.
+     *
+     *  With a dispatcher, the channels' callbacks run on it, keyed by topic,
+     *  and the socket's message callbacks are queued onto pool, so this may
+     *  be called from the receiving thread.
      *
+     *  \param envelope The message.
      *  \return void
      */
-    void sendHeartbeat();
+    void onConnEnvelope(PhxEnvelope envelope);
 
     /**
-     *  \brief Sets this->canSendHeartbeat.
-     *
-     *  This is intended to be a semi-thread safe way to set this flag.
+     *  \brief Calls the callbacks added with onMessage.
      *
-     *  \param canSendHeartbeat Indicating whether or not this socket can
-     *  continue sending heartbeats.
+     *  \param message The message as JSON.
      *  \return void
      */
-    void setCanSendHeartBeat(bool canSendHeartbeat);
+    void triggerMessageCallbacks(const nlohmann::json& message);
 
     /**
-     *  \brief Sets this->canReconnect.
+     *  \brief Triggers a "phx_error" event to all channels.
      *
-     *  This is intended to be a semi-thread safe way to set this flag.
+     *  \param error The error message.
+     *  \return void
+     */
+    void triggerChanError(const std::string& error);
+
+    /**
+     *  \brief Sends a heartbeat to keep Websocket connection alive.
      *
-     *  \param canReconnect Indicating whether or not the socket can reconnect.
      *  \return void
      */
-    void setCanReconnect(bool canReconnect);
+    void sendHeartbeat();
 
     // SocketDelegate
     void webSocketDidOpen(WebSocket* socket);
     void webSocketDidReceive(WebSocket* socket, const std::string& message);
+    void webSocketDidReceive(WebSocket* socket, std::string&& message);
+    void webSocketDidReceiveBinary(
+        WebSocket* socket, const std::vector<uint8_t>& message);
+    void webSocketDidReceiveBinary(
+        WebSocket* socket, std::vector<uint8_t>&& message);
     void webSocketDidError(WebSocket* socket, const std::string& error);
     void webSocketDidClose(
         WebSocket* socket, int code, const std::string& reason, bool wasClean);
@@ -215,6 +271,45 @@ public:
         int interval,
         std::shared_ptr<WebSocket> socket);
 
+    /**
+     *  \brief Constructor using a shared reactor.
+     *
+     *  The EasySocket created on connect is serviced by reactor's I/O
+     *  threads instead of a thread of its own, and socket events run there
+     *  too rather than on a thread per PhxSocket, so many PhxSockets can
+     *  share a handful of threads. Callbacks must then not block, and the
+     *  PhxSocket must not be destroyed on one of reactor's threads.
+     *
+     *  \param url The URL to connect to.
+     *  \param interval The heartbeat interval.
+     *  \param reactor The reactor to register the connection with.
+     *  \return PhxSocket
+     */
+    PhxSocket(const std::string& url,
+        int interval,
+        std::shared_ptr<PhxReactor> reactor);
+
+    /**
+     *  \brief Constructor running channel callbacks on a dispatcher.
+     *
+     *  The same as calling setDispatcher before connecting. A
+     *  PhxLaneDispatcher gives each topic a fixed lane of its own thread.
+     *
+     *  \param url The URL to connect to.
+     *  \param interval The heartbeat interval.
+     *  \param dispatcher The dispatcher, see setDispatcher.
+     *  \return PhxSocket
+     */
+    PhxSocket(const std::string& url,
+        int interval,
+        std::shared_ptr<PhxDispatcher> dispatcher);
+
+    /**
+     *  \brief Destructor. Cancels any pending heartbeat or reconnect timer,
+     *  waiting for one that is firing, since both capture this.
+     */
+    ~PhxSocket();
+
     /**
      *  \brief Connects the Websocket.
      *
@@ -302,14 +397,71 @@ public:
     /**
      *  \brief Send data through websockets.
      *
+     *  data is a message in the 1.0.0 object form. It is re-encoded if the
+     *  socket speaks another format.
+     *
      *  \param data The json data to send.
      *  \return void
      */
     void push(nlohmann::json data);
 
+    /**
+     *  \brief Send a message through websockets.
+     *
+     *  \param topic The topic of the message.
+     *  \param event The event of the message.
+     *  \param payload The payload of the message.
+     *  \param ref The ref of the message, -1 for none.
+     *  \param joinRef The ref of the join the message belongs to, -1 for
+     *  none.
+     *  \return void
+     */
+    void push(const std::string& topic,
+        const std::string& event,
+        const nlohmann::json& payload,
+        int64_t ref,
+        int64_t joinRef);
+
+    /**
+     *  \brief Sets the serializer used from the next connect on.
+     *
+     *  By default the serializer follows the vsn param passed to connect,
+     *  or found in the URL: "2.0.0" selects the array format and anything
+     *  else the object format. Once a serializer is set, its vsn is sent
+     *  instead. This is how binary serializers such as PhxBinarySerializer
+     *  are used.
+     *
+     *  \param serializer The serializer.
+     *  \return void
+     */
+    void setSerializer(std::shared_ptr<PhxSerializer> serializer);
+
+    /**
+     *  \brief Runs channel callbacks on a dispatcher.
+     *
+     *  By default every channel callback runs on the socket's one serial
+     *  queue. With a dispatcher, each message and channel error is handed
+     *  to it keyed by topic: callbacks for one topic still run one at a
+     *  time and in order, but different topics may run in parallel, so
+     *  callbacks must not assume they share a thread. Socket callbacks
+     *  added with onOpen, onMessage and the like stay on the serial queue.
+     *
+     *  Messages are then routed on the thread that receives them and go
+     *  straight to the dispatcher rather than through the serial queue, so
+     *  changing dispatchers while connected may reorder a topic's messages
+     *  around the switch.
+     *
+     *  \param dispatcher The dispatcher, such as a PhxWorkStealingDispatcher,
+     *  or null to go back to the serial queue.
+     *  \return void
+     */
+    void setDispatcher(std::shared_ptr<PhxDispatcher> dispatcher);
+
     /**
      *  \brief Adds PhxChannel to list of channels.
      *
+     *  Adding a channel that is already registered does nothing.
+     *
      *  \return void
      */
     void addChannel(std::shared_ptr<PhxChannel> channel);
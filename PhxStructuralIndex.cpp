@@ -0,0 +1,220 @@
+#include "PhxStructuralIndex.h"
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PHX_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(PHX_SSE2) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__i386__))
+// AVX2 is compiled per function and picked at runtime, so the build itself
+// does not need -mavx2.
+#define PHX_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/*!< Bitmasks of one 64 byte block, bit i standing for byte i. */
+struct Block {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+};
+
+typedef void (*classify_fn)(const char* data, Block& block);
+
+#ifndef PHX_SSE2
+bool isOp(char c) {
+    return c == '{' || c == '}' || c == '[' || c == ']' || c == ':'
+        || c == ',';
+}
+
+void classifyScalar(const char* data, Block& block) {
+    block.quote = block.backslash = block.op = 0;
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = uint64_t(1) << i;
+        char c = data[i];
+        if (c == '"') {
+            block.quote |= bit;
+        } else if (c == '\\') {
+            block.backslash |= bit;
+        } else if (isOp(c)) {
+            block.op |= bit;
+        }
+    }
+}
+#endif
+
+#ifdef PHX_SSE2
+uint64_t opMask16(__m128i v) {
+    __m128i ops = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))));
+    ops = _mm_or_si128(ops,
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    return uint32_t(_mm_movemask_epi8(ops));
+}
+
+void classifySse2(const char* data, Block& block) {
+    block.quote = block.backslash = block.op = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i * 16));
+        int shift = i * 16;
+        block.quote |= uint64_t(uint32_t(_mm_movemask_epi8(
+                           _mm_cmpeq_epi8(v, _mm_set1_epi8('"')))))
+            << shift;
+        block.backslash |= uint64_t(uint32_t(_mm_movemask_epi8(
+                               _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')))))
+            << shift;
+        block.op |= opMask16(v) << shift;
+    }
+}
+#endif
+
+#ifdef PHX_AVX2
+__attribute__((target("avx2"))) uint64_t opMask32(__m256i v) {
+    __m256i ops = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))));
+    ops = _mm256_or_si256(ops,
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+    return uint32_t(_mm256_movemask_epi8(ops));
+}
+
+__attribute__((target("avx2"))) void classifyAvx2(
+    const char* data, Block& block) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)data);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(data + 32));
+    __m256i quote = _mm256_set1_epi8('"');
+    __m256i backslash = _mm256_set1_epi8('\\');
+    block.quote
+        = uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, quote))))
+        | uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, quote))))
+            << 32;
+    block.backslash = uint64_t(uint32_t(
+                          _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, backslash))))
+        | uint64_t(uint32_t(
+              _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, backslash))))
+            << 32;
+    block.op = opMask32(lo) | opMask32(hi) << 32;
+}
+#endif
+
+classify_fn selectClassify() {
+#ifdef PHX_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return classifyAvx2;
+    }
+#endif
+#ifdef PHX_SSE2
+    return classifySse2;
+#else
+    return classifyScalar;
+#endif
+}
+
+classify_fn classifier() {
+    static const classify_fn impl = selectClassify();
+    return impl;
+}
+
+int lowestBit(uint64_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return int(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Bits of characters escaped by a backslash, i.e. preceded by an odd run
+// of backslashes. prevEscaped carries whether the first byte of the next
+// block is escaped. This is simdjson's find_escaped.
+uint64_t findEscaped(uint64_t backslash, uint64_t& prevEscaped) {
+    backslash &= ~prevEscaped;
+    uint64_t followsEscape = backslash << 1 | prevEscaped;
+    const uint64_t evenBits = 0x5555555555555555ULL;
+    uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+    uint64_t evenStarts = oddStarts + backslash;
+    prevEscaped = evenStarts < oddStarts ? 1 : 0; // carried out of bit 63
+    uint64_t invert = evenStarts << 1;
+    return (evenBits ^ invert) & followsEscape;
+}
+
+// Sets every bit from each set bit up to (not including) the next one.
+uint64_t prefixXor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+} // namespace
+
+bool PhxStructuralIndex::build(
+    const char* data, size_t size, std::vector<uint32_t>& positions) {
+    positions.clear();
+    // Each structural character takes at least a byte, and most JSON has
+    // one every handful of bytes.
+    positions.reserve(size / 4 + 8);
+
+    const classify_fn classify = classifier();
+    uint64_t prevEscaped = 0;
+    uint64_t prevInString = 0;
+    char tail[64];
+    for (size_t base = 0; base < size; base += 64) {
+        const char* block = data + base;
+        if (size - base < 64) {
+            std::memset(tail, ' ', sizeof(tail));
+            std::memcpy(tail, block, size - base);
+            block = tail;
+        }
+
+        Block masks;
+        classify(block, masks);
+
+        uint64_t quotes = masks.quote & ~findEscaped(masks.backslash, prevEscaped);
+        // Set from an opening quote up to its closing quote.
+        uint64_t inString = prefixXor(quotes) ^ prevInString;
+        prevInString = uint64_t(int64_t(inString) >> 63);
+
+        uint64_t structural = (masks.op & ~inString) | quotes;
+        while (structural) {
+            int bit = lowestBit(structural);
+            positions.push_back(uint32_t(base + bit));
+            structural &= structural - 1;
+        }
+    }
+
+    return prevInString == 0;
+}
+
+const char* PhxStructuralIndex::implementation() {
+#ifdef PHX_AVX2
+    if (classifier() == classifyAvx2) {
+        return "avx2";
+    }
+#endif
+#ifdef PHX_SSE2
+    if (classifier() == classifySse2) {
+        return "sse2";
+    }
+#endif
+    return "scalar";
+}
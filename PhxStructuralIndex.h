@@ -0,0 +1,44 @@
+/**
+ *   \file PhxStructuralIndex.h
+ *   \brief Finds the structure of a JSON text without parsing it.
+ *
+ *  The index lists, in order, the offset of every quote that opens or
+ *  closes a string and of every '{', '}', '[', ']', ':' and ',' outside
+ *  strings. With it a reader can hop from key to value to the end of a
+ *  nested payload without looking at the bytes in between.
+ *
+ *  The text is classified 64 bytes at a time, in the spirit of simdjson's
+ *  first stage: quotes, backslashes and operators become bitmasks (with
+ *  AVX2 or SSE2 where the CPU has them, picked at runtime), escaped quotes
+ *  and string interiors are then removed with a few integer operations.
+ *  The text is not validated.
+ */
+#ifndef PhxStructuralIndex_H
+#define PhxStructuralIndex_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class PhxStructuralIndex {
+public:
+    /**
+     *  \brief Indexes a JSON text.
+     *
+     *  \param data The text.
+     *  \param size Its length, which must be below 4GB.
+     *  \param positions Receives the offsets of the structural characters.
+     *  \return bool false if a string is left unterminated.
+     */
+    static bool build(
+        const char* data, size_t size, std::vector<uint32_t>& positions);
+
+    /**
+     *  \brief The name of the implementation build() uses on this CPU.
+     *
+     *  \return const char* "avx2", "sse2" or "scalar".
+     */
+    static const char* implementation();
+};
+
+#endif
@@ -0,0 +1,191 @@
+/**
+ *   \file PhxTask.h
+ *   \brief A move-only callable that stores small callables inline.
+ *
+ *  std::function must be copyable and allocates for anything larger than a
+ *  couple of pointers, which is most lambdas that capture a string. PhxTask
+ *  keeps any callable of up to INLINE_SIZE bytes inside itself and only
+ *  allocates for larger ones, so handing a typical lambda to a queue costs
+ *  no allocation. Callables may be move-only.
+ */
+#ifndef PhxTask_H
+#define PhxTask_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+class PhxTask {
+public:
+    /*!< The largest callable stored without allocating. */
+    static const size_t INLINE_SIZE = 48;
+
+private:
+    /*!< What PhxTask needs to know about the callable it holds. */
+    struct Ops {
+        void (*invoke)(void* storage);
+
+        /*!< Move constructs into dst from src, then destroys src. */
+        void (*relocate)(void* dst, void* src);
+
+        void (*destroy)(void* storage);
+    };
+
+    /*!< Ops for a callable kept in storage. */
+    template <class F> struct InlineOps {
+        static void invoke(void* storage) {
+            (*static_cast<F*>(storage))();
+        }
+
+        static void relocate(void* dst, void* src) {
+            ::new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+
+        static void destroy(void* storage) {
+            static_cast<F*>(storage)->~F();
+        }
+
+        static const Ops ops;
+    };
+
+    /*!< Ops for a callable on the heap, storage holding a pointer to it. */
+    template <class F> struct HeapOps {
+        static void invoke(void* storage) {
+            (**static_cast<F**>(storage))();
+        }
+
+        static void relocate(void* dst, void* src) {
+            *static_cast<F**>(dst) = *static_cast<F**>(src);
+        }
+
+        static void destroy(void* storage) {
+            delete *static_cast<F**>(storage);
+        }
+
+        static const Ops ops;
+    };
+
+    /*!<
+     * Whether F goes in storage. Relocating must not throw, as tasks move
+     * around inside queues.
+     */
+    template <class F> struct FitsInline {
+        static const bool value = sizeof(F) <= INLINE_SIZE
+            && alignof(F) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<F>::value;
+    };
+
+    /*!< The callable's ops, null when empty. */
+    const Ops* ops;
+
+    /*!< The callable, or a pointer to it. */
+    typename std::aligned_storage<INLINE_SIZE,
+        alignof(std::max_align_t)>::type storage;
+
+    template <class F>
+    void init(F&& f, std::true_type) {
+        typedef typename std::decay<F>::type Callable;
+        ::new (&this->storage) Callable(std::forward<F>(f));
+        this->ops = &InlineOps<Callable>::ops;
+    }
+
+    template <class F>
+    void init(F&& f, std::false_type) {
+        typedef typename std::decay<F>::type Callable;
+        *reinterpret_cast<Callable**>(&this->storage)
+            = new Callable(std::forward<F>(f));
+        this->ops = &HeapOps<Callable>::ops;
+    }
+
+public:
+    PhxTask()
+        : ops(nullptr) {
+    }
+
+    PhxTask(std::nullptr_t)
+        : ops(nullptr) {
+    }
+
+    /**
+     *  \brief Constructor
+     *
+     *  \param f The callable, taking no arguments. Its result is ignored.
+     *  \return PhxTask
+     */
+    template <class F,
+        class = typename std::enable_if<!std::is_same<
+            typename std::decay<F>::type, PhxTask>::value>::type>
+    PhxTask(F&& f)
+        : ops(nullptr) {
+        this->init(std::forward<F>(f),
+            std::integral_constant<bool,
+                FitsInline<typename std::decay<F>::type>::value>());
+    }
+
+    PhxTask(PhxTask&& other) noexcept
+        : ops(other.ops) {
+        if (this->ops) {
+            this->ops->relocate(&this->storage, &other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    PhxTask& operator=(PhxTask&& other) noexcept {
+        if (this != &other) {
+            *this = nullptr;
+            if (other.ops) {
+                other.ops->relocate(&this->storage, &other.storage);
+                this->ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    PhxTask& operator=(std::nullptr_t) {
+        if (this->ops) {
+            this->ops->destroy(&this->storage);
+            this->ops = nullptr;
+        }
+        return *this;
+    }
+
+    PhxTask(const PhxTask&) = delete;
+    PhxTask& operator=(const PhxTask&) = delete;
+
+    ~PhxTask() {
+        *this = nullptr;
+    }
+
+    /**
+     *  \brief Whether a callable is held.
+     *
+     *  \return bool
+     */
+    explicit operator bool() const {
+        return this->ops != nullptr;
+    }
+
+    /**
+     *  \brief Calls the callable. Must not be empty.
+     *
+     *  \return void
+     */
+    void operator()() {
+        this->ops->invoke(&this->storage);
+    }
+};
+
+template <class F>
+const PhxTask::Ops PhxTask::InlineOps<F>::ops
+    = { &PhxTask::InlineOps<F>::invoke, &PhxTask::InlineOps<F>::relocate,
+          &PhxTask::InlineOps<F>::destroy };
+
+template <class F>
+const PhxTask::Ops PhxTask::HeapOps<F>::ops
+    = { &PhxTask::HeapOps<F>::invoke, &PhxTask::HeapOps<F>::relocate,
+          &PhxTask::HeapOps<F>::destroy };
+
+#endif
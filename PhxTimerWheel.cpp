@@ -0,0 +1,256 @@
+#include "PhxTimerWheel.h"
+
+PhxTimerWheel::PhxTimerWheel()
+    : now(0)
+    , epoch(std::chrono::steady_clock::now())
+    , nextId(1)
+    , stop(false) {
+    for (int level = 0; level < LEVELS; level++) {
+        for (uint64_t i = 0; i < SLOTS; i++) {
+            Node& head = this->wheel[level][i].head;
+            head.prev = &head;
+            head.next = &head;
+        }
+    }
+
+    this->worker = std::thread([this]() { this->run(); });
+}
+
+PhxTimerWheel::~PhxTimerWheel() {
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->stop = true;
+    }
+    this->condition.notify_all();
+    this->worker.join();
+
+    for (auto& it : this->timers) {
+        delete it.second;
+    }
+}
+
+PhxTimerWheel& PhxTimerWheel::shared() {
+    static PhxTimerWheel wheel;
+    return wheel;
+}
+
+uint64_t PhxTimerWheel::toTicks(std::chrono::milliseconds delay) {
+    return delay.count() > 0 ? (uint64_t)delay.count() : 1;
+}
+
+PhxTimerWheel::TimerId PhxTimerWheel::schedule(
+    std::chrono::milliseconds delay, Callback callback) {
+    return this->add(toTicks(delay), 0, std::move(callback));
+}
+
+PhxTimerWheel::TimerId PhxTimerWheel::scheduleRepeating(
+    std::chrono::milliseconds interval, Callback callback) {
+    uint64_t ticks = toTicks(interval);
+    return this->add(ticks, ticks, std::move(callback));
+}
+
+PhxTimerWheel::TimerId PhxTimerWheel::add(
+    uint64_t delay, uint64_t period, Callback callback) {
+    Node* node = new Node();
+    node->period = period;
+    node->firing = false;
+    node->running = false;
+    node->cancelled = false;
+    node->callback = std::move(callback);
+
+    TimerId id;
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        id = this->nextId++;
+        node->id = id;
+
+        // Schedule relative to the wall clock rather than the last processed
+        // tick, which lags while the wheel thread sleeps. Round the partial
+        // current tick up so timers never fire early.
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - this->epoch)
+                               .count()
+            + 1;
+        node->expires = (elapsed > this->now ? elapsed : this->now) + delay;
+        this->timers[id] = node;
+        this->place(node);
+    }
+
+    this->condition.notify_one();
+    return id;
+}
+
+bool PhxTimerWheel::cancel(TimerId id) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    auto it = this->timers.find(id);
+    if (it == this->timers.end()) {
+        return false;
+    }
+
+    Node* node = it->second;
+    if (node->firing) {
+        // The wheel thread owns the node until it is done with it; it will
+        // see the flag, skip the callback if it has not started and not
+        // re-arm it.
+        if (node->cancelled) {
+            return false;
+        }
+        node->cancelled = true;
+        bool pending = node->period || !node->running;
+        if (node->running
+            && std::this_thread::get_id() != this->worker.get_id()) {
+            // A cancelled node is always freed once its callback returns.
+            this->fired.wait(lock, [this, id]() {
+                return this->timers.find(id) == this->timers.end();
+            });
+        }
+        return pending;
+    }
+
+    unlink(node);
+    this->timers.erase(it);
+    delete node;
+    return true;
+}
+
+size_t PhxTimerWheel::size() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    return this->timers.size();
+}
+
+void PhxTimerWheel::place(Node* node) {
+    uint64_t expires = node->expires;
+    uint64_t delta = expires > this->now ? expires - this->now : 0;
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (SLOTS << (level * SLOT_BITS))) {
+        level++;
+    }
+
+    // Timers beyond the top level's range park in it and are re-placed
+    // each time that slot cascades; tick() checks the real expiry.
+    uint64_t range = (uint64_t)1 << (LEVELS * SLOT_BITS);
+    if (delta >= range) {
+        expires = this->now + range - 1;
+    }
+
+    Node& head
+        = this->wheel[level][(expires >> (level * SLOT_BITS)) & SLOT_MASK].head;
+    node->prev = head.prev;
+    node->next = &head;
+    head.prev->next = node;
+    head.prev = node;
+}
+
+void PhxTimerWheel::unlink(Node* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node;
+    node->next = node;
+}
+
+void PhxTimerWheel::cascade(Slot& slot) {
+    // Detach the whole list first since place() may put nodes back here.
+    Node& head = slot.head;
+    if (head.next == &head) {
+        return;
+    }
+
+    Node* node = head.next;
+    head.prev->next = nullptr;
+    head.prev = &head;
+    head.next = &head;
+
+    while (node) {
+        Node* next = node->next;
+        this->place(node);
+        node = next;
+    }
+}
+
+void PhxTimerWheel::tick(std::vector<Node*>& expired) {
+    this->now++;
+
+    // Each time a level wraps, pull the next slot of the level above down.
+    for (int level = 1; level < LEVELS; level++) {
+        uint64_t shift = (uint64_t)(level - 1) * SLOT_BITS;
+        if (((this->now >> shift) & SLOT_MASK) != 0) {
+            break;
+        }
+        this->cascade(
+            this->wheel[level][(this->now >> (level * SLOT_BITS)) & SLOT_MASK]);
+    }
+
+    Node& head = this->wheel[0][this->now & SLOT_MASK].head;
+    while (head.next != &head) {
+        Node* node = head.next;
+        unlink(node);
+        if (node->expires <= this->now) {
+            node->firing = true;
+            expired.push_back(node);
+        } else {
+            this->place(node);
+        }
+    }
+}
+
+uint64_t PhxTimerWheel::ticksUntilNextEvent() {
+    uint64_t untilCascade = SLOTS - (this->now & SLOT_MASK);
+    for (uint64_t i = 1; i < untilCascade; i++) {
+        Node& head = this->wheel[0][(this->now + i) & SLOT_MASK].head;
+        if (head.next != &head) {
+            return i;
+        }
+    }
+
+    return untilCascade;
+}
+
+void PhxTimerWheel::run() {
+    std::vector<Node*> expired;
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (!this->stop) {
+        uint64_t target = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - this->epoch)
+                              .count();
+        while (this->now < target) {
+            this->tick(expired);
+        }
+
+        if (!expired.empty()) {
+            for (Node* node : expired) {
+                if (!node->cancelled) {
+                    // Run callbacks without the lock so they may schedule or
+                    // cancel timers themselves.
+                    node->running = true;
+                    lock.unlock();
+                    node->callback();
+                    lock.lock();
+                    node->running = false;
+                }
+
+                node->firing = false;
+                if (node->period && !node->cancelled) {
+                    node->expires = this->now + node->period;
+                    this->place(node);
+                } else {
+                    this->timers.erase(node->id);
+                    delete node;
+                }
+                this->fired.notify_all();
+            }
+            expired.clear();
+            continue;
+        }
+
+        if (this->timers.empty()) {
+            this->condition.wait(lock);
+        } else {
+            this->condition.wait_until(lock,
+                this->epoch
+                    + std::chrono::milliseconds(
+                          this->now + this->ticksUntilNextEvent()));
+        }
+    }
+}
@@ -0,0 +1,226 @@
+/**
+ *   \file PhxTimerWheel.h
+ *   \brief A hierarchical timer wheel shared by heartbeats, reconnects and
+ *   push timeouts.
+ *
+ *  Timers live in four levels of 64 slots each, with a 1ms tick at the
+ *  lowest level. Scheduling and cancelling a timer are O(1); timers far in
+ *  the future are cascaded down a level at a time as the wheel turns. A
+ *  single thread drives the wheel and sleeps until the next slot that can
+ *  hold an expiring timer, so idle wheels cost nothing.
+ *
+ *  Callbacks run on the wheel's thread and should hand real work off
+ *  (for example to PhxSocket's pool) rather than block it.
+ */
+#ifndef PhxTimerWheel_H
+#define PhxTimerWheel_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class PhxTimerWheel {
+public:
+    /*!< Identifies a scheduled timer. 0 is never a valid id. */
+    typedef uint64_t TimerId;
+
+    /*!< Called on the wheel thread when a timer expires. */
+    using Callback = std::function<void()>;
+
+private:
+    struct Node {
+        Node* prev;
+        Node* next;
+        TimerId id;
+
+        /*!< The tick this timer expires on. */
+        uint64_t expires;
+
+        /*!< Re-arm interval in ticks, 0 for one-shot timers. */
+        uint64_t period;
+
+        /*!< Set from expiry until the wheel thread is done with it. */
+        bool firing;
+
+        /*!< Set while the callback itself is running. */
+        bool running;
+
+        /*!< Set when cancelled while firing. */
+        bool cancelled;
+
+        Callback callback;
+    };
+
+    /*!< Each slot is the sentinel of a circular doubly linked list. */
+    struct Slot {
+        Node head;
+    };
+
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const uint64_t SLOTS = 1 << SLOT_BITS;
+    static const uint64_t SLOT_MASK = SLOTS - 1;
+
+    /*!< The wheel levels, level 0 having the finest resolution. */
+    Slot wheel[LEVELS][SLOTS];
+
+    /*!< Every live timer by id so cancel() is O(1). */
+    std::unordered_map<TimerId, Node*> timers;
+
+    /*!< The last tick that has been processed. */
+    uint64_t now;
+
+    /*!< Time of tick 0. */
+    std::chrono::steady_clock::time_point epoch;
+
+    /*!< Source of timer ids. */
+    TimerId nextId;
+
+    /*!< Guards everything above. */
+    std::mutex mutex;
+
+    /*!< Wakes the wheel thread when timers are added or on shutdown. */
+    std::condition_variable condition;
+
+    /*!< Signalled each time a callback returns, for cancel() to wait on. */
+    std::condition_variable fired;
+
+    /*!< Flag telling the wheel thread to exit. */
+    bool stop;
+
+    /*!< The thread driving the wheel. */
+    std::thread worker;
+
+    /**
+     *  \brief Converts a delay to a tick count of at least one.
+     *
+     *  \param delay The delay.
+     *  \return uint64_t
+     */
+    static uint64_t toTicks(std::chrono::milliseconds delay);
+
+    /**
+     *  \brief Links a node into the slot matching its expiry.
+     *
+     *  \param node The node to place.
+     *  \return void
+     */
+    void place(Node* node);
+
+    /**
+     *  \brief Unlinks a node from whatever slot holds it.
+     *
+     *  \param node The node to unlink.
+     *  \return void
+     */
+    static void unlink(Node* node);
+
+    /**
+     *  \brief Adds a timer.
+     *
+     *  \param delay Ticks until the first expiry.
+     *  \param period Re-arm interval in ticks, 0 for one-shot.
+     *  \param callback The callback.
+     *  \return TimerId
+     */
+    TimerId add(uint64_t delay, uint64_t period, Callback callback);
+
+    /**
+     *  \brief Moves every node in a slot back through place().
+     *
+     *  \param slot The slot to empty.
+     *  \return void
+     */
+    void cascade(Slot& slot);
+
+    /**
+     *  \brief Advances the wheel by one tick, collecting expired nodes.
+     *
+     *  \param expired Receives the nodes that expired on this tick.
+     *  \return void
+     */
+    void tick(std::vector<Node*>& expired);
+
+    /**
+     *  \brief Ticks until the next slot that may expire a timer.
+     *
+     *  \return uint64_t
+     */
+    uint64_t ticksUntilNextEvent();
+
+    /**
+     *  \brief Body of the wheel thread.
+     *
+     *  \return void
+     */
+    void run();
+
+public:
+    /**
+     *  \brief Constructor. Starts the wheel thread.
+     *
+     *  \return PhxTimerWheel
+     */
+    PhxTimerWheel();
+
+    /**
+     *  \brief Stops the wheel thread and drops pending timers.
+     */
+    ~PhxTimerWheel();
+
+    PhxTimerWheel(const PhxTimerWheel&) = delete;
+    PhxTimerWheel& operator=(const PhxTimerWheel&) = delete;
+
+    /**
+     *  \brief The process wide wheel used by PhxSocket and PhxPush.
+     *
+     *  \return PhxTimerWheel&
+     */
+    static PhxTimerWheel& shared();
+
+    /**
+     *  \brief Schedules a one-shot timer.
+     *
+     *  \param delay How long to wait before calling callback.
+     *  \param callback The callback.
+     *  \return TimerId
+     */
+    TimerId schedule(std::chrono::milliseconds delay, Callback callback);
+
+    /**
+     *  \brief Schedules a timer that fires every interval until cancelled.
+     *
+     *  \param interval The time between calls.
+     *  \param callback The callback.
+     *  \return TimerId
+     */
+    TimerId scheduleRepeating(
+        std::chrono::milliseconds interval, Callback callback);
+
+    /**
+     *  \brief Cancels a timer.
+     *
+     *  The timer is removed from the wheel immediately. If its callback is
+     *  running, it will not fire again and, unless cancel() is called from
+     *  a callback on the wheel thread, cancel() waits for it to return, so
+     *  whatever the callback captured may be destroyed afterwards.
+     *
+     *  \param id The timer to cancel.
+     *  \return bool true if the timer was pending or repeating.
+     */
+    bool cancel(TimerId id);
+
+    /**
+     *  \brief Number of timers currently scheduled.
+     *
+     *  \return size_t
+     */
+    size_t size();
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include <functional>
 #include <string>
 
+class PhxEnvelope;
+
 enum class ChannelState { CLOSED, ERRORED, JOINING, JOINED };
 
 using OnOpen = std::function<void()>;
@@ -12,6 +14,7 @@ using OnClose = std::function<void(const std::string& event)>;
 using OnError = std::function<void(const std::string& error)>;
 using OnMessage = std::function<void(nlohmann::json json)>;
 using OnReceive = std::function<void(nlohmann::json message, int64_t ref)>;
+using OnEnvelope = std::function<void(const PhxEnvelope& envelope)>;
 using After = std::function<void()>;
 
 #endif
@@ -0,0 +1,170 @@
+#include "PhxWorkStealingDispatcher.h"
+
+namespace {
+
+/*!< The dispatcher whose worker is running on this thread, if any. */
+thread_local const PhxWorkStealingDispatcher* currentDispatcher = nullptr;
+
+/*!< Which of its workers this thread is. */
+thread_local size_t currentWorker = 0;
+
+} // namespace
+
+PhxWorkStealingDispatcher::PhxWorkStealingDispatcher(size_t threads)
+    : pending(0)
+    , sleepers(0)
+    , nextWorker(0)
+    , stop(false) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        this->workers.emplace_back(new Worker());
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        this->workers[i]->thread = std::thread([this, i]() { this->work(i); });
+    }
+}
+
+PhxWorkStealingDispatcher::~PhxWorkStealingDispatcher() {
+    {
+        std::lock_guard<std::mutex> guard(this->idleMutex);
+        this->stop = true;
+    }
+    this->idle.notify_all();
+
+    for (std::unique_ptr<Worker>& worker : this->workers) {
+        worker->thread.join();
+    }
+}
+
+PhxWorkStealingDispatcher::Shard& PhxWorkStealingDispatcher::shardFor(
+    size_t key) {
+    return this->shards[key % SHARDS];
+}
+
+void PhxWorkStealingDispatcher::dispatch(size_t key, PhxTask task) {
+    Shard& shard = this->shardFor(key);
+    std::shared_ptr<Strand> idle;
+    {
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        std::shared_ptr<Strand>& strand = shard.strands[key];
+        if (!strand) {
+            // No strand means nothing is queued or running for key, so
+            // this task starts a new one.
+            strand = std::make_shared<Strand>();
+            strand->key = key;
+            idle = strand;
+        }
+        strand->tasks.push_back(std::move(task));
+    }
+
+    if (idle) {
+        this->schedule(std::move(idle));
+    }
+}
+
+void PhxWorkStealingDispatcher::schedule(std::shared_ptr<Strand> strand) {
+    size_t index = currentDispatcher == this
+        ? currentWorker
+        : this->nextWorker++ % this->workers.size();
+
+    // Counted before it is visible so take() never drives pending below
+    // zero. seq_cst, as is sleepers, so either a parking worker sees
+    // pending or we see it in sleepers.
+    this->pending++;
+    {
+        Worker& worker = *this->workers[index];
+        std::lock_guard<std::mutex> guard(worker.mutex);
+        worker.jobs.push_back(std::move(strand));
+    }
+
+    if (this->sleepers > 0) {
+        std::lock_guard<std::mutex> guard(this->idleMutex);
+        this->idle.notify_one();
+    }
+}
+
+bool PhxWorkStealingDispatcher::take(
+    size_t index, std::shared_ptr<Strand>& strand) {
+    size_t count = this->workers.size();
+    for (size_t i = 0; i < count; i++) {
+        Worker& worker = *this->workers[(index + i) % count];
+        std::lock_guard<std::mutex> guard(worker.mutex);
+        if (worker.jobs.empty()) {
+            continue;
+        }
+
+        // Our own strands are taken oldest first, so one that reschedules
+        // itself goes behind the rest. Thieves take the newest.
+        if (i == 0) {
+            strand = std::move(worker.jobs.front());
+            worker.jobs.pop_front();
+        } else {
+            strand = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+        }
+        this->pending--;
+        return true;
+    }
+    return false;
+}
+
+void PhxWorkStealingDispatcher::runStrand(
+    const std::shared_ptr<Strand>& strand) {
+    Shard& shard = this->shardFor(strand->key);
+    std::vector<PhxTask> batch;
+    {
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        batch.swap(strand->tasks);
+    }
+
+    for (PhxTask& task : batch) {
+        // As with PhxSerialQueue, a throwing task must not take the
+        // worker down with it.
+        try {
+            task();
+        } catch (...) {
+        }
+    }
+
+    bool more;
+    {
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        more = !strand->tasks.empty();
+        if (!more) {
+            shard.strands.erase(strand->key);
+        }
+    }
+
+    if (more) {
+        this->schedule(strand);
+    }
+}
+
+void PhxWorkStealingDispatcher::work(size_t index) {
+    currentDispatcher = this;
+    currentWorker = index;
+
+    for (;;) {
+        std::shared_ptr<Strand> strand;
+        if (this->take(index, strand)) {
+            this->runStrand(strand);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(this->idleMutex);
+        if (this->stop && this->pending == 0) {
+            return;
+        }
+        this->sleepers++;
+        this->idle.wait(
+            lock, [this]() { return this->stop || this->pending > 0; });
+        this->sleepers--;
+    }
+}
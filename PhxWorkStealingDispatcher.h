@@ -0,0 +1,149 @@
+/**
+ *   \file PhxWorkStealingDispatcher.h
+ *   \brief A PhxDispatcher running tasks on a work-stealing pool.
+ *
+ *  Each key has a strand: the tasks dispatched with that key, queued in
+ *  order. A strand with work is scheduled on one worker at a time, which
+ *  runs the tasks queued so far before rescheduling it behind other work,
+ *  so a busy topic cannot starve the rest.
+ *
+ *  Each worker has a deque of scheduled strands. A worker takes the oldest
+ *  strand from its own deque and, when that is empty, steals the newest
+ *  from another's, so strands spread over all workers without a shared
+ *  queue. Strands scheduled from a worker go on that worker's deque;
+ *  strands scheduled from elsewhere, such as the socket's queue, are spread
+ *  round robin.
+ */
+#ifndef PhxWorkStealingDispatcher_H
+#define PhxWorkStealingDispatcher_H
+
+#include "PhxDispatcher.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class PhxWorkStealingDispatcher : public PhxDispatcher {
+private:
+    struct Strand {
+        size_t key;
+
+        /*!< Tasks not yet run, oldest first. Guarded by its shard. */
+        std::vector<PhxTask> tasks;
+    };
+
+    /*!< A slice of the strand table, split to keep dispatch uncontended. */
+    struct Shard {
+        std::mutex mutex;
+
+        /*!<
+         * Strands with tasks queued or running, by key. A strand is dropped
+         * once it runs dry, so idle keys cost nothing.
+         */
+        std::unordered_map<size_t, std::shared_ptr<Strand>> strands;
+    };
+
+    struct Worker {
+        /*!< Guards jobs. */
+        std::mutex mutex;
+
+        /*!< Strands scheduled on this worker. */
+        std::deque<std::shared_ptr<Strand>> jobs;
+
+        std::thread thread;
+    };
+
+    static const size_t SHARDS = 64;
+
+    /*!< The strand table. */
+    Shard shards[SHARDS];
+
+    /*!< The workers, one per thread. */
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /*!< Strands scheduled but not yet taken by a worker. */
+    std::atomic<size_t> pending;
+
+    /*!< Workers parked on idle. */
+    std::atomic<int> sleepers;
+
+    /*!< Spreads strands scheduled from outside the pool. */
+    std::atomic<size_t> nextWorker;
+
+    /*!< Set by the destructor once workers should exit. */
+    std::atomic<bool> stop;
+
+    /*!< Guards parking. */
+    std::mutex idleMutex;
+
+    /*!< Signalled when a strand is scheduled while workers are parked. */
+    std::condition_variable idle;
+
+    /**
+     *  \brief The shard holding key.
+     *
+     *  \param key The key.
+     *  \return Shard&
+     */
+    Shard& shardFor(size_t key);
+
+    /**
+     *  \brief Puts a strand on a worker's deque and wakes a parked worker.
+     *
+     *  \param strand The strand, which has tasks and is not scheduled.
+     *  \return void
+     */
+    void schedule(std::shared_ptr<Strand> strand);
+
+    /**
+     *  \brief Takes a strand from the front of index's deque or, failing
+     *  that, steals one from the back of another.
+     *
+     *  \param index The worker looking for work.
+     *  \param strand Receives the strand.
+     *  \return bool false if there was nothing to take.
+     */
+    bool take(size_t index, std::shared_ptr<Strand>& strand);
+
+    /**
+     *  \brief Runs the tasks a strand has queued, then reschedules or
+     *  retires it.
+     *
+     *  \param strand The strand.
+     *  \return void
+     */
+    void runStrand(const std::shared_ptr<Strand>& strand);
+
+    /**
+     *  \brief A worker's loop.
+     *
+     *  \param index The worker.
+     *  \return void
+     */
+    void work(size_t index);
+
+public:
+    /**
+     *  \brief Constructor
+     *
+     *  \param threads Number of workers, 0 for one per core.
+     *  \return PhxWorkStealingDispatcher
+     */
+    explicit PhxWorkStealingDispatcher(size_t threads = 0);
+
+    /**
+     *  \brief Destructor
+     *
+     *  Runs the tasks already dispatched, then joins the workers.
+     */
+    ~PhxWorkStealingDispatcher();
+
+    void dispatch(size_t key, PhxTask task);
+};
+
+#endif
@@ -8,7 +8,9 @@
 
 #ifndef SocketDelegate_H
 #define SocketDelegate_H
+#include <cstdint>
 #include <string>
+#include <vector>
 
 class WebSocket;
 
@@ -36,6 +38,55 @@ public:
         WebSocket* socket, const std::string& message)
         = 0;
 
+    /**
+     *  \brief Callback received when Websocket receives a binary message.
+     *
+     *  Delegates that do not override this get the bytes through
+     *  webSocketDidReceive, as they did before binary messages had a
+     *  callback of their own.
+     *
+     *  \param socket The socket the message arrived on.
+     *  \param message The bytes of the message.
+     *  \return void
+     */
+    virtual void webSocketDidReceiveBinary(
+        WebSocket* socket, const std::vector<uint8_t>& message) {
+        this->webSocketDidReceive(
+            socket, std::string(message.begin(), message.end()));
+    }
+
+    /**
+     *  \brief Callback received when Websocket receives a message it no
+     *  longer needs.
+     *
+     *  The delegate may take the buffer instead of copying it, e.g. to
+     *  hand it to another thread. Delegates that do not override this get
+     *  the message through the const overload.
+     *
+     *  \param socket The socket the message arrived on.
+     *  \param message The message, which the delegate may move from.
+     *  \return void
+     */
+    virtual void webSocketDidReceive(WebSocket* socket, std::string&& message) {
+        const std::string& received = message;
+        this->webSocketDidReceive(socket, received);
+    }
+
+    /**
+     *  \brief Callback received when Websocket receives a binary message it
+     *  no longer needs.
+     *
+     *  \param socket The socket the message arrived on.
+     *  \param message The bytes of the message, which the delegate may move
+     *  from.
+     *  \return void
+     */
+    virtual void webSocketDidReceiveBinary(
+        WebSocket* socket, std::vector<uint8_t>&& message) {
+        const std::vector<uint8_t>& received = message;
+        this->webSocketDidReceiveBinary(socket, received);
+    }
+
     /**
      *  \brief Callback received when Websocket has an error.
      *
@@ -8,7 +8,9 @@
  */
 #ifndef WebSocket_H
 #define WebSocket_H
+#include <cstdint>
 #include <string>
+#include <vector>
 
 class SocketDelegate;
 
@@ -72,8 +74,13 @@ public:
      */
     virtual void send(const std::string& message) = 0;
 
-    // // Send a Data
-    // - (void)sendData:(nullable NSData *)data error:(NSError **)error;
+    /**
+     *  \brief Send a binary message over websockets.
+     *
+     *  \param message The bytes to send as a binary frame.
+     *  \return void
+     */
+    virtual void sendBinary(const std::vector<uint8_t>& message) = 0;
 
     /**
      *  \brief Get SocketState
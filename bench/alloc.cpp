@@ -0,0 +1,92 @@
+/**
+ *   \file alloc.cpp
+ *   \brief Checks that framing an outgoing message does not allocate.
+ *
+ *  Counts every operator new while messages of each header size are
+ *  framed into the transmit buffer, which is emptied between sends the way
+ *  a flush in poll() empties it. Exits non-zero if any send allocated once
+ *  the buffer has grown. easywsclient.cpp is included rather than linked
+ *  to reach _RealWebSocket. From the repository root:
+ *
+ *    g++ -std=c++11 -O2 -pthread -I. bench/alloc.cpp -o bench_alloc
+ */
+#include "easywsclient.cpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<size_t> allocations(0);
+
+} // namespace
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+int main() {
+    // Both sides of each header size boundary.
+    static const size_t sizes[] = { 0, 125, 126, 65535, 65536, 1 << 20 };
+    static const int ROUNDS = 10000;
+
+    // Never connected, so nothing but sendData touches txbuf.
+    _RealWebSocket ws(true, ConnectOptions());
+    std::string text(1 << 20, 'x');
+    std::vector<uint8_t> binary(1 << 20, 0x5a);
+
+    // Grow txbuf to the largest frame once.
+    ws.send(text.data(), text.size());
+    ws.txbuf.clear();
+
+    bool failed = false;
+    for (size_t size : sizes) {
+        size_t before = allocations;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ROUNDS; i++) {
+            if (i & 1) {
+                ws.sendBinary(binary.data(), size);
+            } else {
+                ws.send(text.data(), size);
+            }
+            ws.txbuf.clear();
+            ws.txoff = 0;
+        }
+        std::chrono::duration<double, std::nano> elapsed
+            = std::chrono::steady_clock::now() - start;
+        size_t count = allocations - before;
+        std::printf("%8zu bytes  %10.1f ns/send  %zu allocations\n", size,
+            elapsed.count() / ROUNDS, count);
+        failed = failed || count != 0;
+    }
+
+    size_t before = allocations;
+    for (int i = 0; i < ROUNDS; i++) {
+        ws.sendPing();
+        ws.txbuf.clear();
+        ws.txoff = 0;
+    }
+    size_t count = allocations - before;
+    std::printf("    ping  %33zu allocations\n", count);
+    failed = failed || count != 0;
+
+    return failed ? 1 : 0;
+}
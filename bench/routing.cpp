@@ -0,0 +1,87 @@
+/**
+ *   \file routing.cpp
+ *   \brief Measures routing inbound frames to channels by topic.
+ *
+ *  Feeds frames for random topics to a PhxSocket with a growing number of
+ *  joined channels. A dispatcher that runs tasks inline keeps the whole
+ *  path on this thread, so the time per frame is scanning plus routing;
+ *  it should stay flat as channels are added. From the repository root:
+ *
+ *    g++ -std=c++11 -O2 -pthread -I. bench/routing.cpp PhxSocket.cpp \
+ *        PhxChannel.cpp PhxPush.cpp PhxEnvelope.cpp PhxSerializer.cpp \
+ *        PhxStructuralIndex.cpp PhxSerialQueue.cpp PhxReactor.cpp \
+ *        PhxTimerWheel.cpp EasySocket.cpp easywsclient.cpp \
+ *        easylogging++.cc -o bench_routing
+ */
+#include "PhxChannel.h"
+#include "PhxDispatcher.h"
+#include "PhxSocket.h"
+#include "SocketDelegate.h"
+#include "easylogging++.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+INITIALIZE_EASYLOGGINGPP
+
+namespace {
+
+class InlineDispatcher : public PhxDispatcher {
+public:
+    void dispatch(size_t key, PhxTask task) {
+        task();
+    }
+};
+
+std::string topicFor(int i) {
+    return "room:" + std::to_string(i);
+}
+
+} // namespace
+
+int main() {
+    static const int counts[] = { 1, 10, 100, 1000, 5000, 20000 };
+    static const int FRAMES = 200000;
+
+    std::mt19937 random(42);
+    for (int count : counts) {
+        std::shared_ptr<PhxSocket> socket = std::make_shared<PhxSocket>(
+            "ws://localhost:4000/socket/websocket", 0);
+        socket->setDispatcher(std::make_shared<InlineDispatcher>());
+
+        std::vector<std::shared_ptr<PhxChannel>> channels;
+        for (int i = 0; i < count; i++) {
+            channels.push_back(std::make_shared<PhxChannel>(
+                socket, topicFor(i), std::map<std::string, std::string>()));
+            socket->addChannel(channels.back());
+        }
+
+        std::vector<std::string> frames;
+        for (int i = 0; i < 1024; i++) {
+            frames.push_back("{\"topic\":\"" + topicFor(random() % count)
+                + "\",\"event\":\"new_msg\",\"payload\":{\"body\":\"hi\"},"
+                  "\"ref\":null}");
+        }
+
+        // Called the way EasySocket delivers a received frame.
+        SocketDelegate* delegate = socket.get();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < FRAMES; i++) {
+            delegate->webSocketDidReceive(
+                nullptr, std::string(frames[i & 1023]));
+        }
+        std::chrono::duration<double, std::nano> elapsed
+            = std::chrono::steady_clock::now() - start;
+        std::printf("%6d channels  %8.1f ns/frame\n", count,
+            elapsed.count() / FRAMES);
+
+        // Channels hold the socket, so break the cycle.
+        for (const std::shared_ptr<PhxChannel>& channel : channels) {
+            socket->removeChannel(channel);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ *   \file serial_queue.cpp
+ *   \brief Measures ThreadPool against PhxSerialQueue under contention.
+ *
+ *  Eight producer threads post small tasks to one consumer, timed until
+ *  the consumer has run them all. Compares ThreadPool with one thread,
+ *  which PhxSocket used before, with PhxSerialQueue on its own thread and
+ *  on a reactor. From the repository root:
+ *
+ *    g++ -std=c++11 -O2 -pthread -I. bench/serial_queue.cpp \
+ *        PhxSerialQueue.cpp PhxReactor.cpp -o bench_serial_queue
+ */
+#include "PhxReactor.h"
+#include "PhxSerialQueue.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int PRODUCERS = 8;
+const int TASKS_PER_PRODUCER = 250000;
+
+// The task every queue runs, small enough to be stored inline.
+struct Increment {
+    std::atomic<long>* done;
+
+    void operator()() const {
+        done->fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// Returns millions of tasks per second; post hands one task to the queue.
+template <class Post> double measure(Post post) {
+    const long total = long(PRODUCERS) * TASKS_PER_PRODUCER;
+    std::atomic<long> done(0);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&]() {
+            while (!go) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < TASKS_PER_PRODUCER; i++) {
+                post(Increment{ &done });
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+    while (done.load(std::memory_order_relaxed) < total) {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+    return total / elapsed.count() / 1e6;
+}
+
+} // namespace
+
+int main() {
+    std::printf("%d producers, %d tasks each\n", PRODUCERS, TASKS_PER_PRODUCER);
+
+    {
+        ThreadPool pool(1);
+        double rate = measure([&pool](Increment task) { pool.enqueue(task); });
+        std::printf("%-28s %8.2f M tasks/s\n", "ThreadPool(1)", rate);
+    }
+
+    {
+        PhxSerialQueue queue;
+        double rate
+            = measure([&queue](Increment task) { queue.post(task); });
+        std::printf("%-28s %8.2f M tasks/s\n", "PhxSerialQueue", rate);
+    }
+
+    {
+        PhxSerialQueue queue(std::make_shared<PhxReactor>(1));
+        double rate
+            = measure([&queue](Increment task) { queue.post(task); });
+        std::printf("%-28s %8.2f M tasks/s\n", "PhxSerialQueue on a reactor",
+            rate);
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ *   \file structural_index.cpp
+ *   \brief Measures envelope scanning against parsing the frame as json.
+ *
+ *  For frames with small to large payloads, times reading topic, event
+ *  and ref by nlohmann::json::parse, as onConnMessage used to, against
+ *  PhxEnvelope::scan, and reports the rate of PhxStructuralIndex::build
+ *  alone. From the repository root:
+ *
+ *    g++ -std=c++11 -O2 -I. bench/structural_index.cpp PhxEnvelope.cpp \
+ *        PhxStructuralIndex.cpp -o bench_structural_index
+ *
+ *  Add -U__SSE2__ to time the scalar classifier instead.
+ */
+#include "PhxEnvelope.h"
+#include "PhxStructuralIndex.h"
+#include "json.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+// A frame whose payload is an array of count messages.
+std::string makeFrame(int count) {
+    std::string payload = "[";
+    for (int i = 0; i < count; i++) {
+        if (i) {
+            payload += ',';
+        }
+        payload += "{\"id\":" + std::to_string(i)
+            + ",\"user\":\"user-" + std::to_string(i % 97)
+            + "\",\"body\":\"she said \\\"hi\\\" at 10:00, {ok}\","
+              "\"tags\":[\"a\",\"b\"],\"seen\":true}";
+    }
+    payload += ']';
+    return "{\"topic\":\"room:lobby\",\"event\":\"new_msg\",\"payload\":"
+        + payload + ",\"ref\":\"42\"}";
+}
+
+template <class F> double nanosPer(int rounds, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        f();
+    }
+    std::chrono::duration<double, std::nano> elapsed
+        = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / rounds;
+}
+
+} // namespace
+
+int main() {
+    static const int counts[] = { 0, 1, 40, 2500 };
+
+    std::printf("structural index: %s\n", PhxStructuralIndex::implementation());
+    std::printf("%10s %14s %14s %10s %12s\n", "bytes", "parse ns", "scan ns",
+        "speedup", "index GB/s");
+
+    size_t sink = 0;
+    for (int count : counts) {
+        std::string frame = makeFrame(count);
+        int rounds = int(200000000 / (frame.size() + 1000));
+
+        double parse = nanosPer(rounds, [&]() {
+            nlohmann::json json = nlohmann::json::parse(frame);
+            sink += json["topic"].get<std::string>().size()
+                + json["event"].get<std::string>().size()
+                + json["ref"].get<std::string>().size();
+        });
+
+        double scan = nanosPer(rounds, [&]() {
+            PhxEnvelope envelope;
+            if (envelope.scan(frame)) {
+                sink += envelope.getTopic().size() + envelope.getEvent().size()
+                    + size_t(envelope.getRef());
+            }
+        });
+
+        std::vector<uint32_t> positions;
+        double index = nanosPer(rounds, [&]() {
+            PhxStructuralIndex::build(frame.data(), frame.size(), positions);
+            sink += positions.size();
+        });
+
+        std::printf("%10zu %14.1f %14.1f %9.1fx %12.2f\n", frame.size(),
+            parse, scan, parse / scan, frame.size() / index);
+    }
+
+    // Keeps the work from being optimised away.
+    std::fprintf(stderr, "checksum %zu\n", sink);
+    return 0;
+}
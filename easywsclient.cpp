@@ -40,10 +40,12 @@
     #define socketerrno WSAGetLastError()
     #define SOCKET_EAGAIN_EINPROGRESS WSAEINPROGRESS
     #define SOCKET_EWOULDBLOCK WSAEWOULDBLOCK
+    #define SOCKET_EINPROGRESS WSAEWOULDBLOCK
 #else
     #include <fcntl.h>
     #include <netdb.h>
     #include <netinet/tcp.h>
+    #include <poll.h>
     #include <stdio.h>
     #include <stdlib.h>
     #include <string.h>
@@ -52,6 +54,10 @@
     #include <sys/types.h>
     #include <unistd.h>
     #include <stdint.h>
+    #ifdef __linux__
+        #include <sys/epoll.h>
+        #include <sys/eventfd.h>
+    #endif
     #ifndef _SOCKET_T_DEFINED
         typedef int socket_t;
         #define _SOCKET_T_DEFINED
@@ -67,46 +73,468 @@
     #define socketerrno errno
     #define SOCKET_EAGAIN_EINPROGRESS EAGAIN
     #define SOCKET_EWOULDBLOCK EWOULDBLOCK
+    #define SOCKET_EINPROGRESS EINPROGRESS
 #endif
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <vector>
 #include <string>
 
+#ifdef EASYWSCLIENT_DEFLATE
+    #include <zlib.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define EASYWSCLIENT_SSE2 1
+    #include <emmintrin.h>
+#endif
+#if defined(EASYWSCLIENT_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // AVX2 is compiled per function and picked at runtime, so the build
+    // itself does not need -mavx2.
+    #define EASYWSCLIENT_AVX2 1
+    #include <immintrin.h>
+#endif
+
 #include "easywsclient.hpp"
 
 using easywsclient::Callback_Imp;
 using easywsclient::BytesCallback_Imp;
+using easywsclient::MessageCallback_Imp;
+typedef easywsclient::WebSocket::ConnectOptions ConnectOptions;
+typedef easywsclient::WebSocket::ConnectTimings ConnectTimings;
 
 namespace { // private module-only namespace
 
-socket_t hostname_connect(const std::string& hostname, int port) {
-    struct addrinfo hints;
-    struct addrinfo *result;
-    struct addrinfo *p;
-    int ret;
-    socket_t sockfd = INVALID_SOCKET;
-    char sport[16];
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    snprintf(sport, 16, "%d", port);
-    if ((ret = getaddrinfo(hostname.c_str(), sport, &hints, &result)) != 0)
-    {
-      fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
-      return 1;
-    }
-    for(p = result; p != NULL; p = p->ai_next)
-    {
-        sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (sockfd == INVALID_SOCKET) { continue; }
-        if (connect(sockfd, p->ai_addr, p->ai_addrlen) != SOCKET_ERROR) {
-            break;
-        }
-        closesocket(sockfd);
-        sockfd = INVALID_SOCKET;
-    }
-    freeaddrinfo(result);
-    return sockfd;
+// Payload masking (RFC 6455 section 5.3): XOR every byte with the 4-byte
+// masking key, in place. The kernels below all start at key phase 0, which
+// is where every frame payload starts.
+typedef void (*mask_fn)(uint8_t* data, size_t size, const uint8_t key[4]);
+
+void mask_scalar(uint8_t* data, size_t size, const uint8_t key[4]) {
+    // Eight bytes at a time; memcpy keeps the loads alignment-safe and
+    // compiles down to plain moves.
+    uint64_t key64;
+    memcpy(&key64, key, 4);
+    memcpy((uint8_t*) &key64 + 4, key, 4);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word ^= key64;
+        memcpy(data + i, &word, 8);
+    }
+    for (; i < size; ++i) { data[i] ^= key[i & 0x3]; }
+}
+
+#ifdef EASYWSCLIENT_SSE2
+void mask_sse2(uint8_t* data, size_t size, const uint8_t key[4]) {
+    int32_t key32;
+    memcpy(&key32, key, 4);
+    const __m128i k = _mm_set1_epi32(key32);
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (data + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*) (data + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*) (data + i + 48));
+        _mm_storeu_si128((__m128i*) (data + i), _mm_xor_si128(a, k));
+        _mm_storeu_si128((__m128i*) (data + i + 16), _mm_xor_si128(b, k));
+        _mm_storeu_si128((__m128i*) (data + i + 32), _mm_xor_si128(c, k));
+        _mm_storeu_si128((__m128i*) (data + i + 48), _mm_xor_si128(d, k));
+    }
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (data + i));
+        _mm_storeu_si128((__m128i*) (data + i), _mm_xor_si128(a, k));
+    }
+    // i is a multiple of 4 here, so the key phase is still 0.
+    mask_scalar(data + i, size - i, key);
+}
+#endif
+
+#ifdef EASYWSCLIENT_AVX2
+// Payloads follow a 2 to 14 byte header in txbuf, so they rarely start
+// aligned; aligning the 32-byte stores is what lets AVX2 beat SSE2 here.
+__attribute__((target("avx2")))
+void mask_avx2(uint8_t* data, size_t size, const uint8_t key[4]) {
+    size_t head = (32 - ((uintptr_t) data & 31)) & 31;
+    if (head > size) { head = size; }
+    mask_scalar(data, head, key);
+    data += head;
+    size -= head;
+    // The rest starts at key phase head & 3.
+    uint8_t rotated[4];
+    for (int j = 0; j < 4; ++j) { rotated[j] = key[(head + j) & 0x3]; }
+    int32_t key32;
+    memcpy(&key32, rotated, 4);
+    const __m256i k = _mm256_set1_epi32(key32);
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128) {
+        __m256i* p = (__m256i*) (data + i);
+        _mm256_store_si256(p, _mm256_xor_si256(_mm256_load_si256(p), k));
+        _mm256_store_si256(p + 1, _mm256_xor_si256(_mm256_load_si256(p + 1), k));
+        _mm256_store_si256(p + 2, _mm256_xor_si256(_mm256_load_si256(p + 2), k));
+        _mm256_store_si256(p + 3, _mm256_xor_si256(_mm256_load_si256(p + 3), k));
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i* p = (__m256i*) (data + i);
+        _mm256_store_si256(p, _mm256_xor_si256(_mm256_load_si256(p), k));
+    }
+    // GCC does not clear the upper halves before the tail call, and
+    // legacy SSE code running with them dirty stalls on every instruction.
+    _mm256_zeroupper();
+    mask_sse2(data + i, size - i, rotated);
+}
+#endif
+
+mask_fn select_mask() {
+#ifdef EASYWSCLIENT_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) { return mask_avx2; }
+#endif
+#ifdef EASYWSCLIENT_SSE2
+    return mask_sse2;
+#else
+    return mask_scalar;
+#endif
+}
+
+// Below this the AVX2 kernel's alignment and set-up cost more than its
+// wider stores save; bench/mask.cpp measures where it starts to win.
+const size_t MASK_AVX2_MIN = 1024;
+
+void mask_bytes(uint8_t* data, size_t size, const uint8_t key[4]) {
+    static const mask_fn impl = select_mask();
+    // Control frames and tiny messages are not worth a call through the
+    // dispatch pointer.
+    if (size < 16) {
+        for (size_t i = 0; i < size; ++i) { data[i] ^= key[i & 0x3]; }
+        return;
+    }
+#ifdef EASYWSCLIENT_SSE2
+    if (size < MASK_AVX2_MIN) {
+        mask_sse2(data, size, key);
+        return;
+    }
+#endif
+    impl(data, size, key);
+}
+
+// SHA-1 (FIPS 180-1), only needed to check Sec-WebSocket-Accept.
+void sha1(const std::string& input, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    std::string msg = input;
+    uint64_t bits = (uint64_t) input.size() * 8;
+    msg += (char) 0x80;
+    while (msg.size() % 64 != 56) { msg += (char) 0x00; }
+    for (int i = 7; i >= 0; --i) { msg += (char) ((bits >> (i * 8)) & 0xff); }
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            const uint8_t* p = (const uint8_t*) msg.data() + chunk + i * 4;
+            w[i] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+        }
+        for (int i = 16; i < 80; ++i) {
+            uint32_t v = w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16];
+            w[i] = (v << 1) | (v >> 31);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d; d = c; c = (b << 30) | (b >> 2); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for (int i = 0; i < 5; ++i) {
+        digest[i*4+0] = (h[i] >> 24) & 0xff;
+        digest[i*4+1] = (h[i] >> 16) & 0xff;
+        digest[i*4+2] = (h[i] >> 8) & 0xff;
+        digest[i*4+3] = (h[i] >> 0) & 0xff;
+    }
+}
+
+std::string base64_encode(const uint8_t* data, size_t size) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((size + 2) / 3 * 4);
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t v = (uint32_t) data[i] << 16;
+        if (i + 1 < size) { v |= (uint32_t) data[i+1] << 8; }
+        if (i + 2 < size) { v |= data[i+2]; }
+        out += table[(v >> 18) & 0x3f];
+        out += table[(v >> 12) & 0x3f];
+        out += i + 1 < size ? table[(v >> 6) & 0x3f] : '=';
+        out += i + 2 < size ? table[v & 0x3f] : '=';
+    }
+    return out;
+}
+
+// A fresh Sec-WebSocket-Key: 16 random bytes, base64 encoded (RFC 6455 4.1).
+std::string make_websocket_key() {
+    std::random_device rd;
+    uint8_t nonce[16];
+    for (int i = 0; i < 16; i += 4) {
+        uint32_t r = rd();
+        memcpy(nonce + i, &r, 4);
+    }
+    return base64_encode(nonce, sizeof(nonce));
+}
+
+std::string websocket_accept_for(const std::string& key) {
+    uint8_t digest[20];
+    sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", digest);
+    return base64_encode(digest, sizeof(digest));
+}
+
+// The whole upgrade request, so it can go out in a single write.
+std::string build_upgrade_request(const std::string& host, int port, const std::string& path, const std::string& origin, const std::string& key, const std::string& extensions) {
+    std::string request;
+    request.reserve(256 + host.size() + path.size() + origin.size());
+    request += "GET /"; request += path; request += " HTTP/1.1\r\n";
+    request += "Host: "; request += host;
+    if (port != 80) { request += ":"; request += std::to_string(port); }
+    request += "\r\n";
+    request += "Upgrade: websocket\r\n";
+    request += "Connection: Upgrade\r\n";
+    if (!origin.empty()) { request += "Origin: "; request += origin; request += "\r\n"; }
+    request += "Sec-WebSocket-Key: "; request += key; request += "\r\n";
+    request += "Sec-WebSocket-Version: 13\r\n";
+    if (!extensions.empty()) { request += "Sec-WebSocket-Extensions: "; request += extensions; request += "\r\n"; }
+    request += "\r\n";
+    return request;
+}
+
+bool header_name_is(const char* line, size_t len, const char* name) {
+    size_t n = strlen(name);
+    if (len <= n || line[n] != ':') { return false; }
+    for (size_t i = 0; i < n; ++i) {
+        char a = line[i], b = name[i];
+        if (a >= 'A' && a <= 'Z') { a += 'a' - 'A'; }
+        if (b >= 'A' && b <= 'Z') { b += 'a' - 'A'; }
+        if (a != b) { return false; }
+    }
+    return true;
+}
+
+// Parses a buffered upgrade response. Returns 0 while the header block is
+// still incomplete, -1 if it is invalid, or 1 with header_len set to the
+// number of bytes it spans; anything after that is already WebSocket data.
+// Any Sec-WebSocket-Extensions values are joined into extensions.
+int parse_upgrade_response(const char* data, size_t size, const std::string& key, size_t& header_len, std::string& extensions, const std::string& url) {
+    const char* end = NULL;
+    for (size_t i = 3; i < size; ++i) {
+        if (data[i-3] == '\r' && data[i-2] == '\n' && data[i-1] == '\r' && data[i] == '\n') { end = data + i + 1; break; }
+    }
+    if (!end) {
+        if (size >= 8192) { fprintf(stderr, "ERROR: Upgrade response too large connecting to: %s\n", url.c_str()); return -1; }
+        return 0;
+    }
+    header_len = end - data;
+
+    int status;
+    if (sscanf(data, "HTTP/1.1 %d", &status) != 1 || status != 101) {
+        const char* eol = (const char*) memchr(data, '\r', header_len);
+        fprintf(stderr, "ERROR: Got bad status connecting to %s: %.*s\n", url.c_str(), (int) (eol ? eol - data : 0), data);
+        return -1;
+    }
+
+    std::string expected = websocket_accept_for(key);
+    bool accepted = false;
+    const char* line = (const char*) memchr(data, '\n', header_len) + 1;
+    while (line < end) {
+        const char* eol = (const char*) memchr(line, '\r', end - line);
+        size_t len = eol - line;
+        if (header_name_is(line, len, "Sec-WebSocket-Accept")) {
+            const char* value = line + strlen("Sec-WebSocket-Accept") + 1;
+            while (value < eol && (*value == ' ' || *value == '\t')) { ++value; }
+            const char* value_end = eol;
+            while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) { --value_end; }
+            accepted = std::string(value, value_end) == expected;
+        }
+        else if (header_name_is(line, len, "Sec-WebSocket-Extensions")) {
+            const char* value = line + strlen("Sec-WebSocket-Extensions") + 1;
+            if (!extensions.empty()) { extensions += ","; }
+            extensions.append(value, eol);
+        }
+        line = eol + 2;
+    }
+    if (!accepted) {
+        fprintf(stderr, "ERROR: Missing or wrong Sec-WebSocket-Accept connecting to: %s\n", url.c_str());
+        return -1;
+    }
+    return 1;
+}
+
+#ifdef EASYWSCLIENT_DEFLATE
+// What the server agreed to in its permessage-deflate response.
+struct DeflateParams {
+    int clientWindowBits;
+    bool clientNoContextTakeover;
+    bool serverNoContextTakeover;
+};
+
+std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) { return std::string(); }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+// Our single offer. client_max_window_bits is always sent, bare when we take
+// any window, so the server is free to shrink ours (RFC 7692 7.1.2.2).
+std::string deflate_offer(const easywsclient::WebSocket::DeflateOptions& options) {
+    if (!options.enabled) { return std::string(); }
+    std::string offer = "permessage-deflate; client_max_window_bits";
+    if (options.clientMaxWindowBits < 15) { offer += "=" + std::to_string(options.clientMaxWindowBits); }
+    if (options.serverMaxWindowBits < 15) { offer += "; server_max_window_bits=" + std::to_string(options.serverMaxWindowBits); }
+    if (options.clientNoContextTakeover) { offer += "; client_no_context_takeover"; }
+    if (options.serverNoContextTakeover) { offer += "; server_no_context_takeover"; }
+    return offer;
+}
+
+// Checks the server's response against our offer (RFC 7692 7.1). Returns
+// false for anything we must fail the connection over.
+bool parse_deflate_response(const std::string& value, const easywsclient::WebSocket::DeflateOptions& options, DeflateParams& agreed) {
+    agreed.clientWindowBits = options.clientMaxWindowBits;
+    agreed.clientNoContextTakeover = options.clientNoContextTakeover;
+    agreed.serverNoContextTakeover = false;
+    if (value.find(',') != std::string::npos) { return false; } // we offered one extension
+    bool seenClientBits = false, seenServerBits = false, seenClientReset = false, seenServerReset = false;
+    size_t pos = value.find(';');
+    if (trim(value.substr(0, pos)) != "permessage-deflate") { return false; }
+    while (pos != std::string::npos) {
+        size_t next = value.find(';', pos + 1);
+        std::string param = trim(value.substr(pos + 1, next == std::string::npos ? next : next - pos - 1));
+        pos = next;
+        std::string name = param, arg;
+        size_t eq = param.find('=');
+        if (eq != std::string::npos) {
+            name = trim(param.substr(0, eq));
+            arg = trim(param.substr(eq + 1));
+            if (arg.size() >= 2 && arg[0] == '"' && arg[arg.size() - 1] == '"') { arg = arg.substr(1, arg.size() - 2); }
+        }
+        int bits = arg.empty() ? 0 : atoi(arg.c_str());
+        if (name == "client_no_context_takeover" && eq == std::string::npos && !seenClientReset) {
+            seenClientReset = true;
+            agreed.clientNoContextTakeover = true;
+        }
+        else if (name == "server_no_context_takeover" && eq == std::string::npos && !seenServerReset) {
+            seenServerReset = true;
+            agreed.serverNoContextTakeover = true;
+        }
+        else if (name == "client_max_window_bits" && bits >= 8 && bits <= 15 && !seenClientBits) {
+            seenClientBits = true;
+            // zlib cannot deflate with a 256 byte window.
+            if (bits < 9) { return false; }
+            if (bits < agreed.clientWindowBits) { agreed.clientWindowBits = bits; }
+        }
+        else if (name == "server_max_window_bits" && bits >= 8 && bits <= 15 && !seenServerBits) {
+            // We inflate with the largest window, which reads any smaller one.
+            seenServerBits = true;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+bool parse_url(const std::string& url, std::string& host, int& port, std::string& path) {
+    // Sized from the url itself, so long query strings are fine.
+    std::vector<char> hostbuf(url.size() + 1);
+    std::vector<char> pathbuf(url.size() + 1);
+    if (false) { }
+    else if (sscanf(url.c_str(), "ws://%[^:/]:%d/%s", &hostbuf[0], &port, &pathbuf[0]) == 3) {
+    }
+    else if (sscanf(url.c_str(), "ws://%[^:/]/%s", &hostbuf[0], &pathbuf[0]) == 2) {
+        port = 80;
+    }
+    else if (sscanf(url.c_str(), "ws://%[^:/]:%d", &hostbuf[0], &port) == 2) {
+        pathbuf[0] = '\0';
+    }
+    else if (sscanf(url.c_str(), "ws://%[^:/]", &hostbuf[0]) == 1) {
+        port = 80;
+        pathbuf[0] = '\0';
+    }
+    else {
+        return false;
+    }
+    host = &hostbuf[0];
+    path = &pathbuf[0];
+    return true;
+}
+
+// A getaddrinfo() call running on its own thread. The socket and the
+// thread share it, so whichever lets go last frees it; a socket that gives
+// up sets cancelled and the thread then frees the result itself.
+struct ResolveJob {
+    std::mutex mutex;
+    bool done;
+    bool cancelled;
+    int error;
+    struct addrinfo* result;
+    std::function<void()> notify; // called with mutex held once done
+
+    ResolveJob() : done(false), cancelled(false), error(0), result(NULL) { }
+};
+
+std::shared_ptr<ResolveJob> resolve_async(const std::string& host, int port, std::function<void()> notify) {
+    std::shared_ptr<ResolveJob> job = std::make_shared<ResolveJob>();
+    job->notify = notify;
+    std::thread([job, host, port]() {
+        struct addrinfo hints;
+        struct addrinfo* result = NULL;
+        char sport[16];
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        snprintf(sport, 16, "%d", port);
+        int ret = getaddrinfo(host.c_str(), sport, &hints, &result);
+        std::lock_guard<std::mutex> guard(job->mutex);
+        if (job->cancelled) {
+            if (ret == 0) { freeaddrinfo(result); }
+            return;
+        }
+        job->error = ret;
+        job->result = ret == 0 ? result : NULL;
+        job->done = true;
+        job->notify();
+    }).detach();
+    return job;
+}
+
+void set_nonblocking(socket_t sockfd) {
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(sockfd, FIONBIO, &on);
+#else
+    fcntl(sockfd, F_SETFL, O_NONBLOCK);
+#endif
+}
+
+// poll(2) rather than select(), whose fd_set cannot hold descriptors past
+// FD_SETSIZE; a process serving thousands of sockets gets there quickly.
+int poll_sockets(struct pollfd* fds, size_t count, int timeout) {
+#ifdef _WIN32
+    return WSAPoll(fds, (ULONG) count, timeout);
+#else
+    return ::poll(fds, (nfds_t) count, timeout);
+#endif
+}
+
+long long micros_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
 }
 
 
@@ -114,14 +542,26 @@ class _DummyWebSocket : public easywsclient::WebSocket
 {
   public:
     void poll(int timeout) { }
+    void wait(int timeout) { }
+    void interrupt() { }
     void send(const std::string& message) { }
+    void send(const char* message, size_t size) { }
     void sendBinary(const std::string& message) { }
     void sendBinary(const std::vector<uint8_t>& message) { }
+    void sendBinary(const uint8_t* message, size_t size) { }
     void sendPing() { }
     void close() { } 
+    void requestClose() { }
     readyStateValues getReadyState() const { return CLOSED; }
+    int getFd() const { return -1; }
+    int nextTimeout() const { return -1; }
+    void setWakeCallback(std::function<void()> callback) { }
+    ConnectTimings getConnectTimings() const { ConnectTimings timings = ConnectTimings(); return timings; }
+    void setTxLinger(int micros, size_t bytes) { }
+    Stats getStats() const { Stats stats = Stats(); return stats; }
     void _dispatch(Callback_Imp & callable) { }
     void _dispatchBinary(BytesCallback_Imp& callable) { }
+    void _dispatchMessage(MessageCallback_Imp& callable) { }
 };
 
 
@@ -151,6 +591,7 @@ class _RealWebSocket : public easywsclient::WebSocket
     struct wsheader_type {
         unsigned header_size;
         bool fin;
+        bool rsv1;
         bool mask;
         enum opcode_type {
             CONTINUATION = 0x0,
@@ -168,19 +609,602 @@ class _RealWebSocket : public easywsclient::WebSocket
     std::vector<uint8_t> rxbuf;
     std::vector<uint8_t> txbuf;
     std::vector<uint8_t> receivedData;
+    bool receivedBinary; // whether receivedData began with a binary frame
+    bool receivedCompressed; // whether receivedData is deflated (RSV1 on its first frame)
+
+#ifdef EASYWSCLIENT_DEFLATE
+    // permessage-deflate, once the server has accepted our offer. Each
+    // direction keeps its LZ77 window across messages unless the matching
+    // no_context_takeover was agreed.
+    bool deflateActive;
+    bool txResetEachMessage;
+    bool rxResetEachMessage;
+    z_stream txStream;
+    z_stream rxStream;
+    std::vector<uint8_t> deflated; // the last outgoing message, compressed
+    std::vector<uint8_t> inflated; // the current incoming message, inflated
+#endif
+
+    // rxbuf is used as a cursor buffer: bytes [rxbegin, rxend) are received
+    // but not yet dispatched. Frames are parsed in place and the cursors
+    // reset once everything is consumed; the unconsumed tail is only moved
+    // to the front when recv() needs the room.
+    size_t rxbegin;
+    size_t rxend;
+
+    // recv() size adapts to traffic: it doubles whenever a read fills the
+    // whole request and halves after polls that read little, so bulk
+    // replies take few syscalls while idle sockets keep small buffers.
+    enum { RX_CHUNK_MIN = 1500, RX_CHUNK_MAX = 256 * 1024 };
+    size_t rxChunk;
+
+    Stats stats;
+
+    // Bytes of txbuf already handed to the kernel. Frames are appended at
+    // the back and sent from here, so all pending frames leave in a single
+    // send() and the front is only compacted once it is mostly consumed.
+    size_t txoff;
+
+    // Write coalescing: pending frames are held back until they are
+    // lingerBytes long or the oldest is lingerMicros old. 0 disables it.
+    // Atomic as setTxLinger() may come from any thread.
+    std::atomic<int> lingerMicros;
+    std::atomic<size_t> lingerBytes;
+    std::chrono::steady_clock::time_point txSince;
 
     socket_t sockfd;
     readyStateValues readyState;
     bool useMask;
 
-    _RealWebSocket(socket_t sockfd, bool useMask) : sockfd(sockfd), readyState(OPEN), useMask(useMask) {
+    // Wakeup descriptors used by wait()/interrupt(). On Linux a single
+    // eventfd serves as both ends, elsewhere this is a non-blocking pipe.
+    // They are created on first use so sockets that are never waited on
+    // do not pay for them.
+    std::once_flag wakeOnce;
+    int wakeRead;
+    int wakeWrite;
+
+    // Mirrors !txbuf.empty() so wait() can decide on write interest
+    // without touching txbuf from another thread.
+    std::atomic<bool> txPending;
+
+    // Connection setup, advanced by poll() while readyState is CONNECTING:
+    // the name is resolved on a helper thread, connect() runs non-blocking,
+    // then the upgrade request goes out from `request` and the response is
+    // parsed out of rxbuf. Each phase has its own deadline.
+    enum ConnectPhase { RESOLVING, TCP_CONNECTING, HANDSHAKING };
+    ConnectPhase phase;
+    ConnectOptions options;
+    ConnectTimings timings;
+    std::chrono::steady_clock::time_point phaseStart;
+    std::shared_ptr<ResolveJob> resolveJob;
+    struct addrinfo* addresses;
+
+    // Happy eyeballs (RFC 8305): resolved addresses in the order they are
+    // tried, alternating address families, and the connect()s in flight.
+    // A new attempt starts every attemptDelay or as soon as one fails; the
+    // first to connect wins. On Linux the attempts also sit in raceFd, an
+    // epoll set that getFd() hands out so a reactor sees all of them.
+    std::vector<struct addrinfo*> candidates;
+    size_t nextCandidate;
+    std::vector<socket_t> attempts;
+    std::chrono::steady_clock::time_point lastAttempt;
+    int raceFd;
+    std::vector<struct pollfd> pollfds; // scratch for reapAttempts() and wait()
+    std::string url;
+    std::string key;
+    std::string request;
+    size_t requestSent;
+
+    // Guards wakeCallback, which the resolver thread calls.
+    std::mutex wakeMutex;
+    std::function<void()> wakeCallback;
+
+    // Set by requestClose(); poll() does the actual close().
+    std::atomic<bool> closeRequested;
+
+    _RealWebSocket(bool useMask, const ConnectOptions& options) : receivedBinary(false), receivedCompressed(false), rxbegin(0), rxend(0), rxChunk(RX_CHUNK_MIN), stats(), txoff(0), lingerMicros(0), lingerBytes(0), sockfd(INVALID_SOCKET), readyState(CONNECTING), useMask(useMask), wakeRead(-1), wakeWrite(-1), txPending(false), phase(RESOLVING), options(options), timings(), addresses(NULL), nextCandidate(0), raceFd(-1), key(make_websocket_key()), requestSent(0), closeRequested(false) {
+#ifdef EASYWSCLIENT_DEFLATE
+        deflateActive = false;
+        txResetEachMessage = rxResetEachMessage = false;
+#endif
+    }
+
+    ~_RealWebSocket() {
+#ifdef EASYWSCLIENT_DEFLATE
+        if (deflateActive) {
+            deflateEnd(&txStream);
+            inflateEnd(&rxStream);
+        }
+#endif
+        cancelResolve();
+        closeAttempts(INVALID_SOCKET);
+        // Dropped before poll() saw the close through, e.g. by a reactor
+        // socket destroyed right after close().
+        if (readyState != CLOSED && sockfd != INVALID_SOCKET) { closesocket(sockfd); }
+#ifndef _WIN32
+        if (wakeRead >= 0) { ::close(wakeRead); }
+        if (wakeWrite >= 0 && wakeWrite != wakeRead) { ::close(wakeWrite); }
+#endif
+    }
+
+    void openWakeFds() {
+#if defined(__linux__)
+        wakeRead = wakeWrite = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+        int fds[2];
+        if (pipe(fds) == 0) {
+            fcntl(fds[0], F_SETFL, O_NONBLOCK);
+            fcntl(fds[1], F_SETFL, O_NONBLOCK);
+            wakeRead = fds[0];
+            wakeWrite = fds[1];
+        }
+#endif
+    }
+
+    void interrupt() {
+        std::call_once(wakeOnce, &_RealWebSocket::openWakeFds, this);
+#ifndef _WIN32
+        if (wakeWrite >= 0) {
+            uint64_t one = 1;
+            ssize_t ret = ::write(wakeWrite, &one, sizeof(one));
+            (void) ret; // a full pipe/counter already means a wakeup is pending
+        }
+#endif
+    }
+
+    void setWakeCallback(std::function<void()> callback) {
+        std::lock_guard<std::mutex> guard(wakeMutex);
+        wakeCallback = callback;
+    }
+
+    // Wakes whoever polls us, for work no descriptor will signal.
+    void wakePoller() {
+        interrupt();
+        std::lock_guard<std::mutex> guard(wakeMutex);
+        if (wakeCallback) { wakeCallback(); }
+    }
+
+    void requestClose() {
+        closeRequested = true;
+        wakePoller();
+    }
+
+    ConnectTimings getConnectTimings() const {
+        return timings;
+    }
+
+    void startResolve(const std::string& host, int port) {
+        phase = RESOLVING;
+        phaseStart = std::chrono::steady_clock::now();
+        resolveJob = resolve_async(host, port, [this]() { wakePoller(); });
+    }
+
+    void cancelResolve() {
+        if (!resolveJob) { return; }
+        std::lock_guard<std::mutex> guard(resolveJob->mutex);
+        resolveJob->cancelled = true;
+        if (resolveJob->result) {
+            freeaddrinfo(resolveJob->result);
+            resolveJob->result = NULL;
+        }
+        // The job outlives us if the thread is still resolving.
+        resolveJob.reset();
+    }
+
+    // Microseconds left in the current connect phase, -1 if unlimited.
+    long phaseLeft() const {
+        int limit = phase == RESOLVING ? options.resolveTimeout : phase == TCP_CONNECTING ? options.connectTimeout : options.handshakeTimeout;
+        if (limit <= 0) { return -1; }
+        long long left = (long long) limit * 1000 - micros_since(phaseStart);
+        return left > 0 ? (long) left : 0;
+    }
+
+    // Microseconds until advanceConnect() has timed work: the phase
+    // deadline or, while racing, the start of the next attempt.
+    long connectLeft() const {
+        long left = phaseLeft();
+        if (phase == TCP_CONNECTING && nextCandidate < candidates.size()) {
+            long long stagger = (long long) options.attemptDelay * 1000 - micros_since(lastAttempt);
+            if (stagger < 0) { stagger = 0; }
+            if (left < 0 || stagger < left) { left = (long) stagger; }
+        }
+        return left;
+    }
+
+    // Orders the resolved addresses for racing: starting with the family
+    // of the first result, IPv6 and IPv4 addresses take turns.
+    void orderCandidates() {
+        std::vector<struct addrinfo*> preferred;
+        std::vector<struct addrinfo*> other;
+        for (struct addrinfo* p = addresses; p != NULL; p = p->ai_next) {
+            (p->ai_family == addresses->ai_family ? preferred : other).push_back(p);
+        }
+        candidates.clear();
+        for (size_t i = 0; i < preferred.size() || i < other.size(); ++i) {
+            if (i < preferred.size()) { candidates.push_back(preferred[i]); }
+            if (i < other.size()) { candidates.push_back(other[i]); }
+        }
+        nextCandidate = 0;
+    }
+
+    // Closes every attempt except `keep`, and drops the address list.
+    void closeAttempts(socket_t keep) {
+        for (size_t i = 0; i < attempts.size(); ++i) {
+            if (attempts[i] != keep) { closesocket(attempts[i]); }
+        }
+        attempts.clear();
+#ifdef __linux__
+        if (raceFd >= 0) { ::close(raceFd); }
+#endif
+        raceFd = -1;
+        candidates.clear();
+        nextCandidate = 0;
+        if (addresses) { freeaddrinfo(addresses); }
+        addresses = NULL;
+    }
+
+    void failConnect(const char* why) {
+        if (why) { fprintf(stderr, "Unable to connect to %s: %s\n", url.c_str(), why); }
+        cancelResolve();
+        closeAttempts(INVALID_SOCKET);
+        if (sockfd != INVALID_SOCKET) { closesocket(sockfd); }
+        readyState = CLOSED;
+    }
+
+    // Starts a non-blocking connect() to the next candidate address.
+    bool startAttempt() {
+        while (nextCandidate < candidates.size()) {
+            struct addrinfo* p = candidates[nextCandidate++];
+            socket_t fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+            if (fd == INVALID_SOCKET) { continue; }
+            set_nonblocking(fd);
+            if (connect(fd, p->ai_addr, p->ai_addrlen) != SOCKET_ERROR || socketerrno == SOCKET_EINPROGRESS) {
+                attempts.push_back(fd);
+                lastAttempt = std::chrono::steady_clock::now();
+#ifdef __linux__
+                if (raceFd >= 0) {
+                    struct epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLOUT;
+                    ev.data.fd = fd;
+                    epoll_ctl(raceFd, EPOLL_CTL_ADD, fd, &ev);
+                }
+#endif
+                return true;
+            }
+            closesocket(fd);
+        }
+        return false;
+    }
+
+    // Checks the attempts in flight, closing failed ones. Returns the
+    // first one that connected, INVALID_SOCKET if none has yet.
+    socket_t reapAttempts(bool& failed) {
+        failed = false;
+        if (attempts.empty()) { return INVALID_SOCKET; }
+        pollfds.resize(attempts.size());
+        for (size_t i = 0; i < attempts.size(); ++i) {
+            pollfds[i].fd = attempts[i];
+            pollfds[i].events = POLLOUT;
+            pollfds[i].revents = 0;
+        }
+        if (poll_sockets(&pollfds[0], pollfds.size(), 0) <= 0) { return INVALID_SOCKET; }
+        // pollfds[j] describes the attempt at index i until one is erased.
+        for (size_t i = 0, j = 0; j < pollfds.size(); ++j) {
+            socket_t fd = attempts[i];
+            if (!(pollfds[j].revents & (POLLOUT | POLLERR | POLLHUP))) { ++i; continue; }
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*) &err, &len);
+            if (err == 0) { return fd; }
+            closesocket(fd); // also leaves raceFd
+            attempts.erase(attempts.begin() + i);
+            failed = true;
+        }
+        return INVALID_SOCKET;
+    }
+
+    void advanceConnect() {
+        if (phase == RESOLVING) {
+            bool done;
+            int error;
+            struct addrinfo* result;
+            {
+                std::lock_guard<std::mutex> guard(resolveJob->mutex);
+                done = resolveJob->done;
+                error = resolveJob->error;
+                result = resolveJob->result;
+                resolveJob->result = NULL;
+            }
+            if (!done) {
+                if (phaseLeft() == 0) { failConnect("name resolution timed out"); }
+                return;
+            }
+            resolveJob.reset();
+            if (error) { failConnect(gai_strerror(error)); return; }
+            timings.resolve = micros_since(phaseStart);
+            addresses = result;
+            orderCandidates();
+#ifdef __linux__
+            raceFd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+            phase = TCP_CONNECTING;
+            phaseStart = std::chrono::steady_clock::now();
+        }
+        if (phase == TCP_CONNECTING) {
+            socket_t winner;
+            while (true) {
+                bool failed;
+                winner = reapAttempts(failed);
+                if (winner != INVALID_SOCKET) { break; }
+                bool due = attempts.empty() || failed || connectLeft() == 0;
+                if (due && nextCandidate < candidates.size()) {
+                    if (startAttempt()) { continue; }
+                }
+                if (attempts.empty()) { failConnect("no address accepted a connection"); return; }
+                if (phaseLeft() == 0) { failConnect("connect timed out"); }
+                return;
+            }
+            closeAttempts(winner);
+            sockfd = winner;
+            timings.connect = micros_since(phaseStart);
+            int flag = 1;
+            setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char*) &flag, sizeof(flag)); // Disable Nagle's algorithm
+            phase = HANDSHAKING;
+            phaseStart = std::chrono::steady_clock::now();
+        }
+        while (requestSent < request.size()) {
+            int ret = ::send(sockfd, request.data() + requestSent, request.size() - requestSent, 0);
+            stats.txCalls++;
+            if (ret < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) { break; }
+            if (ret <= 0) { failConnect("connection lost during handshake"); return; }
+            requestSent += ret;
+            stats.txBytes += ret;
+        }
+        // Read until the socket would block, so an edge-triggered waiter
+        // is not left without a wakeup. Frames the server sends right
+        // behind the response simply stay in rxbuf.
+        while (true) {
+            rxReserve(rxChunk);
+            ssize_t ret = recv(sockfd, (char*) &rxbuf[rxend], rxbuf.size() - rxend, 0);
+            stats.rxCalls++;
+            if (ret < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) { break; }
+            if (ret <= 0) { failConnect("connection lost during handshake"); return; }
+            rxend += ret;
+            stats.rxBytes += ret;
+        }
+        size_t header_len = 0;
+        std::string extensions;
+        int parsed = parse_upgrade_response((const char*) &rxbuf[0], rxend, key, header_len, extensions, url);
+        if (parsed < 0) { failConnect("handshake rejected"); return; }
+        if (parsed == 0) {
+            if (phaseLeft() == 0) { failConnect("handshake timed out"); }
+            return;
+        }
+        if (!acceptExtensions(extensions)) { return; }
+        rxbegin = header_len;
+        if (rxbegin == rxend) { rxbegin = rxend = 0; }
+        std::string().swap(request);
+        timings.handshake = micros_since(phaseStart);
+        readyState = OPEN;
+        fprintf(stderr, "Connected to: %s (resolve %.1fms, connect %.1fms, handshake %.1fms)\n", url.c_str(),
+            timings.resolve / 1000.0, timings.connect / 1000.0, timings.handshake / 1000.0);
+    }
+
+    // Applies the server's Sec-WebSocket-Extensions, failing the connection
+    // if it enabled anything we did not offer.
+    bool acceptExtensions(const std::string& extensions) {
+        if (extensions.find_first_not_of(" \t") == std::string::npos) { return true; }
+#ifdef EASYWSCLIENT_DEFLATE
+        DeflateParams agreed;
+        if (options.deflate.enabled && parse_deflate_response(extensions, options.deflate, agreed)) {
+            memset(&txStream, 0, sizeof(txStream));
+            memset(&rxStream, 0, sizeof(rxStream));
+            if (deflateInit2(&txStream, options.deflate.level, Z_DEFLATED, -agreed.clientWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                failConnect("could not set up deflate");
+                return false;
+            }
+            if (inflateInit2(&rxStream, -15) != Z_OK) {
+                deflateEnd(&txStream);
+                failConnect("could not set up inflate");
+                return false;
+            }
+            deflateActive = true;
+            txResetEachMessage = agreed.clientNoContextTakeover;
+            rxResetEachMessage = agreed.serverNoContextTakeover;
+            return true;
+        }
+#endif
+        fprintf(stderr, "ERROR: Unexpected Sec-WebSocket-Extensions: %s\n", extensions.c_str());
+        failConnect("extension negotiation failed");
+        return false;
+    }
+
+#ifdef EASYWSCLIENT_DEFLATE
+    // Compresses a message into deflated, without the 00 00 ff ff tail the
+    // sync flush leaves (RFC 7692 7.2.1). Returns the compressed size.
+    size_t deflateMessage(const uint8_t* data, size_t size) {
+        txStream.next_in = (Bytef*) data;
+        txStream.avail_in = (uInt) size;
+        size_t out = 0;
+        // The bound normally fits it all; the limit only stops runaway
+        // growth, like maxInflatedSize does for inflateMessage().
+        size_t bound = deflateBound(&txStream, (uLong) size) + 16;
+        size_t limit = bound > options.deflate.maxInflatedSize ? bound : options.deflate.maxInflatedSize;
+        deflated.resize(bound);
+        while (true) {
+            txStream.next_out = &deflated[out];
+            txStream.avail_out = (uInt) (deflated.size() - out);
+            int ret = deflate(&txStream, Z_SYNC_FLUSH);
+            out = deflated.size() - txStream.avail_out;
+            // The message then goes out uncompressed. Nothing we sent
+            // refers to what the compressor saw, so resetting it is safe.
+            if (ret != Z_OK && ret != Z_BUF_ERROR) { deflateReset(&txStream); return 0; }
+            if (txStream.avail_out != 0) { break; }
+            if (deflated.size() >= limit) { deflateReset(&txStream); return 0; }
+            deflated.resize(deflated.size() * 2 < limit ? deflated.size() * 2 : limit);
+        }
+        if (txResetEachMessage) { deflateReset(&txStream); }
+        stats.txDeflateIn += size;
+        stats.txDeflateOut += out - 4;
+        return out - 4;
+    }
+
+    enum inflateResult { INFLATED, INFLATE_CORRUPT, INFLATE_TOO_BIG };
+
+    // Inflates receivedData into inflated, stopping once it would pass
+    // maxInflatedSize so a small frame cannot expand without bound.
+    inflateResult inflateMessage() {
+        static const uint8_t tail[4] = { 0x00, 0x00, 0xff, 0xff };
+        const size_t limit = options.deflate.maxInflatedSize;
+        size_t in = receivedData.size();
+        receivedData.insert(receivedData.end(), tail, tail + 4);
+        rxStream.next_in = &receivedData[0];
+        rxStream.avail_in = (uInt) receivedData.size();
+        // One byte past the limit tells a message of exactly limit bytes
+        // from a larger one.
+        size_t initial = receivedData.size() * 4 + 64;
+        inflated.resize(initial <= limit ? initial : limit + 1);
+        size_t out = 0;
+        while (true) {
+            rxStream.next_out = &inflated[out];
+            rxStream.avail_out = (uInt) (inflated.size() - out);
+            int ret = inflate(&rxStream, Z_SYNC_FLUSH);
+            out = inflated.size() - rxStream.avail_out;
+            if (out > limit) { return INFLATE_TOO_BIG; }
+            if (ret != Z_OK && ret != Z_BUF_ERROR) { return INFLATE_CORRUPT; }
+            if (rxStream.avail_in == 0 && rxStream.avail_out != 0) { break; }
+            if (ret == Z_BUF_ERROR && rxStream.avail_out != 0) { return INFLATE_CORRUPT; }
+            // reserve() first, or resize() may overshoot the limit.
+            size_t grown = inflated.size() * 2 <= limit ? inflated.size() * 2 : limit + 1;
+            inflated.reserve(grown);
+            inflated.resize(grown);
+        }
+        inflated.resize(out);
+        if (rxResetEachMessage) { inflateReset(&rxStream); }
+        stats.rxInflateIn += in;
+        stats.rxInflateOut += out;
+        return INFLATED;
+    }
+#endif
+
+    void setTxLinger(int micros, size_t bytes) {
+        lingerMicros = micros > 0 ? micros : 0;
+        lingerBytes = bytes;
+    }
+
+    // Microseconds until lingering frames must go out, 0 if they are due
+    // now, -1 if nothing is pending.
+    long txLingerLeft() const {
+        size_t pending = txbuf.size() - txoff;
+        if (!pending) { return -1; }
+        int micros = lingerMicros;
+        size_t bytes = lingerBytes;
+        if (micros == 0 || readyState == CLOSING) { return 0; }
+        if (bytes && pending >= bytes) { return 0; }
+        long waited = (long) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - txSince).count();
+        return waited >= micros ? 0 : micros - waited;
+    }
+
+    Stats getStats() const {
+        Stats current = stats;
+        current.rxChunk = rxChunk;
+        return current;
+    }
+
+    int nextTimeout() const {
+        if (readyState == CONNECTING) {
+            long left = connectLeft();
+            return left < 0 ? -1 : (int) ((left + 999) / 1000);
+        }
+        long left = txLingerLeft();
+        return left <= 0 ? (int) left : (int) ((left + 999) / 1000);
+    }
+
+    void wait(int timeout) { // timeout in milliseconds, < 0 blocks until woken
+        if (readyState == CLOSED || closeRequested) { return; }
+        std::call_once(wakeOnce, &_RealWebSocket::openWakeFds, this);
+        long micros = timeout < 0 ? -1 : (long) timeout * 1000;
+        short sockEvents = POLLIN;
+        pollfds.clear();
+        if (readyState == CONNECTING) {
+            // Nothing to watch while resolving; the resolver interrupts us.
+            if (sockfd != INVALID_SOCKET && requestSent < request.size()) { sockEvents |= POLLOUT; }
+            for (size_t i = 0; i < attempts.size(); ++i) {
+                struct pollfd attempt = { attempts[i], POLLOUT, 0 };
+                pollfds.push_back(attempt);
+            }
+            long left = connectLeft();
+            if (left >= 0 && (micros < 0 || left < micros)) { micros = left; }
+        }
+        else if (txPending) {
+            // Frames still lingering only need us back when they fall due.
+            long left = txLingerLeft();
+            if (left == 0) { sockEvents |= POLLOUT; }
+            else if (left > 0 && (micros < 0 || left < micros)) { micros = left; }
+        }
+        if (sockfd != INVALID_SOCKET) {
+            struct pollfd sock = { sockfd, sockEvents, 0 };
+            pollfds.push_back(sock);
+        }
+#ifdef _WIN32
+        // No portable wakeup descriptor for WSAPoll() here, so bound the
+        // sleep instead; interrupt() latency is then at most one slice.
+        if (micros < 0 || micros > 1000) { micros = 1000; }
+        if (pollfds.empty()) { Sleep((DWORD) (micros / 1000)); return; } // WSAPoll() wants a socket
+#else
+        size_t wakeAt = pollfds.size();
+        if (wakeRead >= 0) {
+            struct pollfd wake = { wakeRead, POLLIN, 0 };
+            pollfds.push_back(wake);
+        }
+#endif
+        // poll() counts milliseconds; round up so a deadline is never
+        // woken for early and spun on.
+        int ms = micros < 0 ? -1 : (int) ((micros + 999) / 1000);
+        poll_sockets(pollfds.empty() ? NULL : &pollfds[0], pollfds.size(), ms);
+#ifndef _WIN32
+        if (wakeAt < pollfds.size() && (pollfds[wakeAt].revents & POLLIN)) {
+            uint64_t drained[8];
+            while (::read(wakeRead, drained, sizeof(drained)) > 0) { }
+        }
+#endif
     }
 
     readyStateValues getReadyState() const {
       return readyState;
     }
 
+    int getFd() const {
+      if (readyState == CONNECTING && phase == TCP_CONNECTING) {
+          if (raceFd >= 0) { return raceFd; }
+          return attempts.empty() ? -1 : (int) attempts.back();
+      }
+      return readyState == CLOSED || sockfd == INVALID_SOCKET ? -1 : (int) sockfd;
+    }
+
+    // Makes room for at least `want` bytes after rxend.
+    void rxReserve(size_t want) {
+        if (rxbuf.size() - rxend >= want) { return; }
+        size_t pending = rxend - rxbegin;
+        if (rxbegin && rxbuf.size() - pending >= want) {
+            // Enough room once the consumed prefix is reclaimed.
+            memmove(&rxbuf[0], &rxbuf[rxbegin], pending);
+            rxbegin = 0;
+            rxend = pending;
+            return;
+        }
+        size_t grown = rxbuf.size() * 2;
+        if (grown < rxend + want) { grown = rxend + want; }
+        rxbuf.resize(grown);
+    }
+
     void poll(int timeout) { // timeout in milliseconds
+        if (closeRequested.exchange(false)) {
+            close();
+            timeout = 0;
+        }
         if (readyState == CLOSED) {
             if (timeout > 0) {
                 timeval tv = { timeout/1000, (timeout%1000) * 1000 };
@@ -188,40 +1212,49 @@ class _RealWebSocket : public easywsclient::WebSocket
             }
             return;
         }
+        if (readyState == CONNECTING) {
+            if (timeout != 0) { wait(timeout); }
+            advanceConnect();
+            if (readyState != OPEN) { return; }
+            timeout = 0;
+        }
         if (timeout != 0) {
-            fd_set rfds;
-            fd_set wfds;
-            timeval tv = { timeout/1000, (timeout%1000) * 1000 };
-            FD_ZERO(&rfds);
-            FD_ZERO(&wfds);
-            FD_SET(sockfd, &rfds);
-            if (txbuf.size()) { FD_SET(sockfd, &wfds); }
-            select(sockfd + 1, &rfds, &wfds, 0, timeout > 0 ? &tv : 0);
+            struct pollfd sock = { sockfd, (short) (txbuf.size() > txoff ? POLLIN | POLLOUT : POLLIN), 0 };
+            poll_sockets(&sock, 1, timeout > 0 ? timeout : -1);
         }
+        size_t polled = 0;
         while (true) {
             // FD_ISSET(0, &rfds) will be true
-            int N = rxbuf.size();
-            ssize_t ret;
-            rxbuf.resize(N + 1500);
-            ret = recv(sockfd, (char*)&rxbuf[0] + N, 1500, 0);
+            rxReserve(rxChunk);
+            // Whatever room the buffer already has is free to fill as well.
+            size_t want = rxbuf.size() - rxend;
+            ssize_t ret = recv(sockfd, (char*)&rxbuf[rxend], want, 0);
+            stats.rxCalls++;
             if (false) { }
             else if (ret < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) {
-                rxbuf.resize(N);
+                if (polled < rxChunk / 4 && rxChunk > RX_CHUNK_MIN) {
+                    rxChunk = rxChunk / 2 < RX_CHUNK_MIN ? RX_CHUNK_MIN : rxChunk / 2;
+                }
                 break;
             }
             else if (ret <= 0) {
-                rxbuf.resize(N);
                 closesocket(sockfd);
                 readyState = CLOSED;
                 fputs(ret < 0 ? "Connection error!\n" : "Connection closed!\n", stderr);
                 break;
             }
             else {
-                rxbuf.resize(N + ret);
+                rxend += ret;
+                polled += ret;
+                stats.rxBytes += ret;
+                if ((size_t) ret == want && rxChunk < RX_CHUNK_MAX) {
+                    rxChunk = rxChunk * 2 > RX_CHUNK_MAX ? RX_CHUNK_MAX : rxChunk * 2;
+                }
             }
         }
-        while (txbuf.size()) {
-            int ret = ::send(sockfd, (char*)&txbuf[0], txbuf.size(), 0);
+        while (readyState != CLOSED && txLingerLeft() == 0) {
+            int ret = ::send(sockfd, (char*)&txbuf[txoff], txbuf.size() - txoff, 0);
+            stats.txCalls++;
             if (false) { } // ??
             else if (ret < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) {
                 break;
@@ -233,13 +1266,23 @@ class _RealWebSocket : public easywsclient::WebSocket
                 break;
             }
             else {
-                txbuf.erase(txbuf.begin(), txbuf.begin() + ret);
+                txoff += ret;
+                stats.txBytes += ret;
             }
         }
-        if (!txbuf.size() && readyState == CLOSING) {
+        if (txoff == txbuf.size()) {
+            txbuf.clear(); // keeps capacity for the next burst
+            txoff = 0;
+        }
+        else if (txoff >= 65536 && txoff * 2 >= txbuf.size()) {
+            txbuf.erase(txbuf.begin(), txbuf.begin() + txoff);
+            txoff = 0;
+        }
+        if (txbuf.size() == txoff && readyState == CLOSING) {
             closesocket(sockfd);
             readyState = CLOSED;
         }
+        txPending = txbuf.size() > txoff;
     }
 
     // Callable must have signature: void(const std::string & message).
@@ -263,17 +1306,32 @@ class _RealWebSocket : public easywsclient::WebSocket
     }
 
     virtual void _dispatchBinary(BytesCallback_Imp & callable) {
+        struct CallbackAdapter : public MessageCallback_Imp
+        {
+            BytesCallback_Imp& callable;
+            CallbackAdapter(BytesCallback_Imp& callable) : callable(callable) { }
+            void operator()(const std::vector<uint8_t>& message, bool binary) {
+                callable(message);
+            }
+        };
+        CallbackAdapter messageCallback(callable);
+        _dispatchMessage(messageCallback);
+    }
+
+    virtual void _dispatchMessage(MessageCallback_Imp & callable) {
         // TODO: consider acquiring a lock on rxbuf...
         while (true) {
             wsheader_type ws;
-            if (rxbuf.size() < 2) { return; /* Need at least 2 */ }
-            const uint8_t * data = (uint8_t *) &rxbuf[0]; // peek, but don't consume
+            size_t avail = rxend - rxbegin;
+            if (avail < 2) { break; /* Need at least 2 */ }
+            uint8_t * data = (uint8_t *) &rxbuf[rxbegin]; // peek, but don't consume
             ws.fin = (data[0] & 0x80) == 0x80;
+            ws.rsv1 = (data[0] & 0x40) == 0x40;
             ws.opcode = (wsheader_type::opcode_type) (data[0] & 0x0f);
             ws.mask = (data[1] & 0x80) == 0x80;
             ws.N0 = (data[1] & 0x7f);
             ws.header_size = 2 + (ws.N0 == 126? 2 : 0) + (ws.N0 == 127? 8 : 0) + (ws.mask? 4 : 0);
-            if (rxbuf.size() < ws.header_size) { return; /* Need: ws.header_size - rxbuf.size() */ }
+            if (avail < ws.header_size) { break; /* Need: ws.header_size - avail */ }
             int i = 0;
             if (ws.N0 < 126) {
                 ws.N = ws.N0;
@@ -309,33 +1367,75 @@ class _RealWebSocket : public easywsclient::WebSocket
                 ws.masking_key[2] = 0;
                 ws.masking_key[3] = 0;
             }
-            if (rxbuf.size() < ws.header_size+ws.N) { return; /* Need: ws.header_size+ws.N - rxbuf.size() */ }
+            if (avail < ws.header_size+ws.N) { break; /* Need: ws.header_size+ws.N - avail */ }
 
             // We got a whole message, now do something with it:
+            uint8_t * payload = data + ws.header_size;
+            bool compressible = false;
+#ifdef EASYWSCLIENT_DEFLATE
+            compressible = deflateActive && (ws.opcode == wsheader_type::TEXT_FRAME || ws.opcode == wsheader_type::BINARY_FRAME);
+#endif
             if (false) { }
+            else if ((data[0] & 0x30) || (ws.rsv1 && !compressible)) {
+                // RSV1 only means anything on the first frame of a message,
+                // and only once permessage-deflate was agreed.
+                fprintf(stderr, "ERROR: Got a frame with unexpected RSV bits.\n");
+                close();
+            }
             else if (
                    ws.opcode == wsheader_type::TEXT_FRAME 
                 || ws.opcode == wsheader_type::BINARY_FRAME
                 || ws.opcode == wsheader_type::CONTINUATION
             ) {
-                if (ws.mask) { for (size_t i = 0; i != ws.N; ++i) { rxbuf[i+ws.header_size] ^= ws.masking_key[i&0x3]; } }
-                receivedData.insert(receivedData.end(), rxbuf.begin()+ws.header_size, rxbuf.begin()+ws.header_size+(size_t)ws.N);// just feed
+                if (ws.mask) { mask_bytes(payload, (size_t) ws.N, ws.masking_key); }
+                if (ws.opcode != wsheader_type::CONTINUATION) {
+                    receivedBinary = ws.opcode == wsheader_type::BINARY_FRAME;
+                    receivedCompressed = ws.rsv1;
+                }
+                receivedData.insert(receivedData.end(), payload, payload+(size_t)ws.N);// just feed
                 if (ws.fin) {
-                    callable((const std::vector<uint8_t>) receivedData);
-                    receivedData.erase(receivedData.begin(), receivedData.end());
-                    std::vector<uint8_t> ().swap(receivedData);// free memory
+#ifdef EASYWSCLIENT_DEFLATE
+                    if (receivedCompressed) {
+                        inflateResult result = inflateMessage();
+                        if (result == INFLATED) {
+                            callable(inflated, receivedBinary);
+                        }
+                        else if (result == INFLATE_TOO_BIG) {
+                            fprintf(stderr, "ERROR: A compressed message inflates past %zu bytes.\n", options.deflate.maxInflatedSize);
+                            close(1009); // message too big
+                        }
+                        else {
+                            fprintf(stderr, "ERROR: Could not inflate a compressed message.\n");
+                            close();
+                        }
+                        if (inflated.capacity() > (1 << 20)) {
+                            std::vector<uint8_t> ().swap(inflated);
+                        }
+                    }
+                    else
+#endif
+                    callable(receivedData, receivedBinary);
+                    receivedData.clear();
+                    if (receivedData.capacity() > (1 << 20)) {
+                        std::vector<uint8_t> ().swap(receivedData);// free memory after huge messages
+                    }
                 }
             }
             else if (ws.opcode == wsheader_type::PING) {
-                if (ws.mask) { for (size_t i = 0; i != ws.N; ++i) { rxbuf[i+ws.header_size] ^= ws.masking_key[i&0x3]; } }
-                std::string data(rxbuf.begin()+ws.header_size, rxbuf.begin()+ws.header_size+(size_t)ws.N);
-                sendData(wsheader_type::PONG, data.size(), data.begin(), data.end());
+                if (ws.mask) { mask_bytes(payload, (size_t) ws.N, ws.masking_key); }
+                sendData(wsheader_type::PONG, ws.N, payload, payload+(size_t)ws.N);
             }
             else if (ws.opcode == wsheader_type::PONG) { }
             else if (ws.opcode == wsheader_type::CLOSE) { close(); }
             else { fprintf(stderr, "ERROR: Got unexpected WebSocket message.\n"); close(); }
 
-            rxbuf.erase(rxbuf.begin(), rxbuf.begin() + ws.header_size+(size_t)ws.N);
+            rxbegin += ws.header_size+(size_t)ws.N;
+        }
+        if (rxbegin == rxend) {
+            rxbegin = rxend = 0;
+            if (rxbuf.size() > 4 * RX_CHUNK_MAX) {
+                std::vector<uint8_t> ().swap(rxbuf);// free memory after huge messages
+            }
         }
     }
 
@@ -345,19 +1445,44 @@ class _RealWebSocket : public easywsclient::WebSocket
     }
 
     void send(const std::string& message) {
-        sendData(wsheader_type::TEXT_FRAME, message.size(), message.begin(), message.end());
+        sendMessage(wsheader_type::TEXT_FRAME, (const uint8_t*) message.data(), message.size());
+    }
+
+    void send(const char* message, size_t size) {
+        sendMessage(wsheader_type::TEXT_FRAME, (const uint8_t*) message, size);
     }
 
     void sendBinary(const std::string& message) {
-        sendData(wsheader_type::BINARY_FRAME, message.size(), message.begin(), message.end());
+        sendMessage(wsheader_type::BINARY_FRAME, (const uint8_t*) message.data(), message.size());
     }
 
     void sendBinary(const std::vector<uint8_t>& message) {
-        sendData(wsheader_type::BINARY_FRAME, message.size(), message.begin(), message.end());
+        sendMessage(wsheader_type::BINARY_FRAME, message.data(), message.size());
+    }
+
+    void sendBinary(const uint8_t* message, size_t size) {
+        sendMessage(wsheader_type::BINARY_FRAME, message, size);
+    }
+
+    // Frames a data message, compressed when permessage-deflate is active
+    // and the message reaches the threshold.
+    void sendMessage(wsheader_type::opcode_type type, const uint8_t* message, size_t size) {
+#ifdef EASYWSCLIENT_DEFLATE
+        if (deflateActive && size > 0 && size >= options.deflate.threshold && readyState == OPEN) {
+            size_t compressed = deflateMessage(message, size);
+            // Without context takeover nothing depends on this message, so
+            // one that did not shrink can still go out as it is.
+            if (compressed && (compressed < size || !txResetEachMessage)) {
+                sendData(type, compressed, deflated.begin(), deflated.begin() + compressed, true);
+                return;
+            }
+        }
+#endif
+        sendData(type, size, message, message + size);
     }
 
     template<class Iterator>
-    void sendData(wsheader_type::opcode_type type, uint64_t message_size, Iterator message_begin, Iterator message_end) {
+    void sendData(wsheader_type::opcode_type type, uint64_t message_size, Iterator message_begin, Iterator message_end, bool compressed = false) {
         // TODO:
         // Masking key should (must) be derived from a high quality random
         // number generator, to mitigate attacks on non-WebSocket friendly
@@ -365,9 +1490,12 @@ class _RealWebSocket : public easywsclient::WebSocket
         const uint8_t masking_key[4] = { 0x12, 0x34, 0x56, 0x78 };
         // TODO: consider acquiring a lock on txbuf...
         if (readyState == CLOSING || readyState == CLOSED) { return; }
-        std::vector<uint8_t> header;
-        header.assign(2 + (message_size >= 126 ? 2 : 0) + (message_size >= 65536 ? 6 : 0) + (useMask ? 4 : 0), 0);
-        header[0] = 0x80 | type;
+        // The header is at most 14 bytes, so build it on the stack and
+        // append it straight into txbuf; once txbuf has grown to the working
+        // set, framing a message allocates nothing.
+        uint8_t header[14];
+        size_t header_size = 2 + (message_size >= 126 ? 2 : 0) + (message_size >= 65536 ? 6 : 0) + (useMask ? 4 : 0);
+        header[0] = 0x80 | (compressed ? 0x40 : 0) | type;
         if (false) { }
         else if (message_size < 126) {
             header[1] = (message_size & 0xff) | (useMask ? 0x80 : 0);
@@ -406,100 +1534,71 @@ class _RealWebSocket : public easywsclient::WebSocket
                 header[13] = masking_key[3];
             }
         }
+        if (lingerMicros && txbuf.size() == txoff) { txSince = std::chrono::steady_clock::now(); }
         // N.B. - txbuf will keep growing until it can be transmitted over the socket:
-        txbuf.insert(txbuf.end(), header.begin(), header.end());
+        txbuf.insert(txbuf.end(), header, header + header_size);
         txbuf.insert(txbuf.end(), message_begin, message_end);
         if (useMask) {
-            for (size_t i = 0; i != message_size; ++i) { *(txbuf.end() - message_size + i) ^= masking_key[i&0x3]; }
+            mask_bytes(&txbuf[txbuf.size() - message_size], message_size, masking_key);
         }
+        txPending = true;
     }
 
     void close() {
         if(readyState == CLOSING || readyState == CLOSED) { return; }
+        if (readyState == CONNECTING) { failConnect(NULL); return; }
         readyState = CLOSING;
         uint8_t closeFrame[6] = {0x88, 0x80, 0x00, 0x00, 0x00, 0x00}; // last 4 bytes are a masking key
-        std::vector<uint8_t> header(closeFrame, closeFrame+6);
-        txbuf.insert(txbuf.end(), header.begin(), header.end());
+        txbuf.insert(txbuf.end(), closeFrame, closeFrame+6);
+        txPending = true;
+    }
+
+    // close() with a status code (RFC 6455 7.4.1) for the server.
+    void close(uint16_t code) {
+        if(readyState == CLOSING || readyState == CLOSED) { return; }
+        if (readyState == CONNECTING) { failConnect(NULL); return; }
+        readyState = CLOSING;
+        // The zero masking key leaves the code as it is.
+        uint8_t closeFrame[8] = {0x88, 0x82, 0x00, 0x00, 0x00, 0x00, (uint8_t) (code >> 8), (uint8_t) (code & 0xff)};
+        txbuf.insert(txbuf.end(), closeFrame, closeFrame+8);
+        txPending = true;
     }
 
 };
 
 
-easywsclient::WebSocket::pointer from_url(const std::string& url, bool useMask, const std::string& origin) {
-    char host[128];
+easywsclient::WebSocket::pointer from_url_async(const std::string& url, bool useMask, const std::string& origin, const ConnectOptions& options) {
+    std::string host;
     int port;
-    char path[128];
-    if (url.size() >= 128) {
-      fprintf(stderr, "ERROR: url size limit exceeded: %s\n", url.c_str());
-      return NULL;
-    }
-    if (origin.size() >= 200) {
-      fprintf(stderr, "ERROR: origin size limit exceeded: %s\n", origin.c_str());
-      return NULL;
-    }
-    if (false) { }
-    else if (sscanf(url.c_str(), "ws://%[^:/]:%d/%s", host, &port, path) == 3) {
-    }
-    else if (sscanf(url.c_str(), "ws://%[^:/]/%s", host, path) == 2) {
-        port = 80;
-    }
-    else if (sscanf(url.c_str(), "ws://%[^:/]:%d", host, &port) == 2) {
-        path[0] = '\0';
-    }
-    else if (sscanf(url.c_str(), "ws://%[^:/]", host) == 1) {
-        port = 80;
-        path[0] = '\0';
-    }
-    else {
+    std::string path;
+    if (!parse_url(url, host, port, path)) {
         fprintf(stderr, "ERROR: Could not parse WebSocket url: %s\n", url.c_str());
         return NULL;
     }
-    fprintf(stderr, "easywsclient: connecting: host=%s port=%d path=/%s\n", host, port, path);
-    socket_t sockfd = hostname_connect(host, port);
-    if (sockfd == INVALID_SOCKET) {
-        fprintf(stderr, "Unable to connect to %s:%d\n", host, port);
-        return NULL;
+    fprintf(stderr, "easywsclient: connecting: host=%s port=%d path=/%s\n", host.c_str(), port, path.c_str());
+    _RealWebSocket* ws = new _RealWebSocket(useMask, options);
+    ws->url = url;
+    std::string extensions;
+#ifdef EASYWSCLIENT_DEFLATE
+    extensions = deflate_offer(options.deflate);
+#endif
+    ws->request = build_upgrade_request(host, port, path, origin, ws->key, extensions);
+    ws->startResolve(host, port);
+    return easywsclient::WebSocket::pointer(ws);
+}
+
+easywsclient::WebSocket::pointer from_url(const std::string& url, bool useMask, const std::string& origin) {
+    // The blocking factories just drive the asynchronous connect to the end.
+    easywsclient::WebSocket::pointer ws = from_url_async(url, useMask, origin, ConnectOptions());
+    if (!ws) { return NULL; }
+    while (ws->getReadyState() == easywsclient::WebSocket::CONNECTING) {
+        ws->poll(-1);
     }
-    {
-        // XXX: this should be done non-blocking,
-        char line[256];
-        int status;
-        int i;
-        snprintf(line, 256, "GET /%s HTTP/1.1\r\n", path); ::send(sockfd, line, strlen(line), 0);
-        if (port == 80) {
-            snprintf(line, 256, "Host: %s\r\n", host); ::send(sockfd, line, strlen(line), 0);
-        }
-        else {
-            snprintf(line, 256, "Host: %s:%d\r\n", host, port); ::send(sockfd, line, strlen(line), 0);
-        }
-        snprintf(line, 256, "Upgrade: websocket\r\n"); ::send(sockfd, line, strlen(line), 0);
-        snprintf(line, 256, "Connection: Upgrade\r\n"); ::send(sockfd, line, strlen(line), 0);
-        if (!origin.empty()) {
-            snprintf(line, 256, "Origin: %s\r\n", origin.c_str()); ::send(sockfd, line, strlen(line), 0);
-        }
-        snprintf(line, 256, "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"); ::send(sockfd, line, strlen(line), 0);
-        snprintf(line, 256, "Sec-WebSocket-Version: 13\r\n"); ::send(sockfd, line, strlen(line), 0);
-        snprintf(line, 256, "\r\n"); ::send(sockfd, line, strlen(line), 0);
-        for (i = 0; i < 2 || (i < 255 && line[i-2] != '\r' && line[i-1] != '\n'); ++i) { if (recv(sockfd, line+i, 1, 0) == 0) { return NULL; } }
-        line[i] = 0;
-        if (i == 255) { fprintf(stderr, "ERROR: Got invalid status line connecting to: %s\n", url.c_str()); return NULL; }
-        if (sscanf(line, "HTTP/1.1 %d", &status) != 1 || status != 101) { fprintf(stderr, "ERROR: Got bad status connecting to %s: %s", url.c_str(), line); return NULL; }
-        // TODO: verify response headers,
-        while (true) {
-            for (i = 0; i < 2 || (i < 255 && line[i-2] != '\r' && line[i-1] != '\n'); ++i) { if (recv(sockfd, line+i, 1, 0) == 0) { return NULL; } }
-            if (line[0] == '\r' && line[1] == '\n') { break; }
-        }
+    if (ws->getReadyState() != easywsclient::WebSocket::OPEN) {
+        delete ws;
+        return NULL;
     }
-    int flag = 1;
-    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char*) &flag, sizeof(flag)); // Disable Nagle's algorithm
-#ifdef _WIN32
-    u_long on = 1;
-    ioctlsocket(sockfd, FIONBIO, &on);
-#else
-    fcntl(sockfd, F_SETFL, O_NONBLOCK);
-#endif
-    fprintf(stderr, "Connected to: %s\n", url.c_str());
-    return easywsclient::WebSocket::pointer(new _RealWebSocket(sockfd, useMask));
+    return ws;
 }
 
 } // end of module-only namespace
@@ -522,5 +1621,9 @@ WebSocket::pointer WebSocket::from_url_no_mask(const std::string& url, const std
     return ::from_url(url, false, origin);
 }
 
+WebSocket::pointer WebSocket::from_url_async(const std::string& url, const std::string& origin, const ConnectOptions& options) {
+    return ::from_url_async(url, true, origin, options);
+}
+
 
 } // namespace easywsclient
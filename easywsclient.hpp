@@ -8,6 +8,7 @@
 // wget https://raw.github.com/dhbaird/easywsclient/master/easywsclient.hpp
 // wget https://raw.github.com/dhbaird/easywsclient/master/easywsclient.cpp
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -15,26 +16,99 @@ namespace easywsclient {
 
 struct Callback_Imp { virtual void operator()(const std::string& message) = 0; };
 struct BytesCallback_Imp { virtual void operator()(const std::vector<uint8_t>& message) = 0; };
+struct MessageCallback_Imp { virtual void operator()(const std::vector<uint8_t>& message, bool binary) = 0; };
 
 class WebSocket {
   public:
     typedef WebSocket * pointer;
     typedef enum readyStateValues { CLOSING, CLOSED, CONNECTING, OPEN } readyStateValues;
 
+    // Transport counters, e.g. rxBytes / rxCalls is the average bytes per recv().
+    struct Stats {
+        unsigned long long rxBytes;
+        unsigned long long rxCalls; // every recv() including the one hitting EAGAIN
+        unsigned long long txBytes;
+        unsigned long long txCalls;
+        size_t rxChunk;             // current adaptive recv() size
+        // permessage-deflate: message bytes compressed and what they came to,
+        // and compressed bytes received and what they inflated to.
+        unsigned long long txDeflateIn;
+        unsigned long long txDeflateOut;
+        unsigned long long rxInflateIn;
+        unsigned long long rxInflateOut;
+    };
+
+    // permessage-deflate (RFC 7692), offered in the handshake when enabled.
+    // It needs a build with EASYWSCLIENT_DEFLATE defined and zlib linked;
+    // otherwise it is never offered.
+    struct DeflateOptions {
+        bool enabled;
+        int clientMaxWindowBits;      // 9..15, the window our compressor may use
+        int serverMaxWindowBits;      // 8..15, asked of the server; 15 leaves it free
+        bool clientNoContextTakeover; // reset our compressor after each message
+        bool serverNoContextTakeover; // ask the server to reset its own
+        size_t threshold;             // messages shorter than this go out uncompressed
+        int level;                    // zlib compression level, -1 for its default
+        size_t maxInflatedSize;       // a message inflating past this closes with 1009 (RFC 7692 8.2)
+        DeflateOptions() : enabled(false), clientMaxWindowBits(15), serverMaxWindowBits(15), clientNoContextTakeover(false), serverNoContextTakeover(false), threshold(128), level(-1), maxInflatedSize(16 << 20) { }
+    };
+
+    // Limits for each phase of from_url_async(), in milliseconds; 0 waits forever.
+    struct ConnectOptions {
+        int resolveTimeout;
+        int connectTimeout;
+        int handshakeTimeout;
+        int attemptDelay; // head start each resolved address gets before the next is tried too (RFC 8305)
+        DeflateOptions deflate;
+        ConnectOptions() : resolveTimeout(10000), connectTimeout(10000), handshakeTimeout(10000), attemptDelay(250) { }
+    };
+
+    // How long each phase of connecting took, in microseconds; 0 until it completes.
+    struct ConnectTimings {
+        long long resolve;
+        long long connect;
+        long long handshake;
+    };
+
     // Factories:
     static pointer create_dummy();
     static pointer from_url(const std::string& url, const std::string& origin = std::string());
     static pointer from_url_no_mask(const std::string& url, const std::string& origin = std::string());
+    // Returns at once in the CONNECTING state (or NULL for a bad url). The
+    // connection is then set up by poll(): the name is resolved on a helper
+    // thread, connect() and the handshake never block, and the socket turns
+    // CLOSED if any phase fails or outlasts its timeout.
+    static pointer from_url_async(const std::string& url, const std::string& origin = std::string(), const ConnectOptions& options = ConnectOptions());
 
     // Interfaces:
+    // Only interrupt(), requestClose(), setWakeCallback() and setTxLinger()
+    // may be called while another thread polls the socket; everything else,
+    // wait(), getFd() and nextTimeout() included, belongs to that thread.
     virtual ~WebSocket() { }
     virtual void poll(int timeout = 0) = 0; // timeout in milliseconds
+    virtual void wait(int timeout = -1) = 0; // blocks until socket activity or interrupt(); -1 waits forever
+    virtual void interrupt() = 0; // wakes a thread blocked in wait(), safe to call from any thread
     virtual void send(const std::string& message) = 0;
+    virtual void send(const char* message, size_t size) = 0;
     virtual void sendBinary(const std::string& message) = 0;
     virtual void sendBinary(const std::vector<uint8_t>& message) = 0;
+    virtual void sendBinary(const uint8_t* message, size_t size) = 0;
     virtual void sendPing() = 0;
     virtual void close() = 0;
+    // close() for any other thread: the thread polling the socket closes it
+    // on its next poll(), so descriptors are only ever closed there.
+    virtual void requestClose() = 0;
     virtual readyStateValues getReadyState() const = 0;
+    virtual int getFd() const = 0; // the underlying descriptor, -1 if there is none; changes while CONNECTING
+    virtual int nextTimeout() const = 0; // ms until poll() has timed work to do, -1 if none
+    // Called from another thread when poll() has work no descriptor will
+    // signal (e.g. name resolution finished). wait() is woken regardless.
+    virtual void setWakeCallback(std::function<void()> callback) = 0;
+    virtual ConnectTimings getConnectTimings() const = 0;
+    // Coalesce outgoing frames: hold them until `bytes` are pending or the
+    // oldest has waited `micros`. Either may be 0; micros == 0 disables it.
+    virtual void setTxLinger(int micros, size_t bytes) = 0;
+    virtual Stats getStats() const = 0;
 
     template<class Callable>
     void dispatch(Callable callable)
@@ -62,9 +136,24 @@ class WebSocket {
         _dispatchBinary(callback);
     }
 
+    template<class Callable>
+    void dispatchMessage(Callable callable)
+        // For callbacks that accept a std::vector<uint8_t> and a bool that is
+        // true if the message came in binary frames rather than text ones.
+    {
+        struct _Callback : public MessageCallback_Imp {
+            Callable& callable;
+            _Callback(Callable& callable) : callable(callable) { }
+            void operator()(const std::vector<uint8_t>& message, bool binary) { callable(message, binary); }
+        };
+        _Callback callback(callable);
+        _dispatchMessage(callback);
+    }
+
   protected:
     virtual void _dispatch(Callback_Imp& callable) = 0;
     virtual void _dispatchBinary(BytesCallback_Imp& callable) = 0;
+    virtual void _dispatchMessage(MessageCallback_Imp& callable) = 0;
 };
 
 } // namespace easywsclient